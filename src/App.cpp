@@ -12,10 +12,22 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/calib3d.hpp>
 #include <filesystem>
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <cmath>
 #include <opencv2/objdetect/aruco_board.hpp>
 #include <opencv2/objdetect/aruco_detector.hpp>
 #include <opencv2/objdetect/charuco_detector.hpp>
 #include <opencv2/aruco.hpp>
+#include "CalibrationStore.hpp"
+#include "FastMarkerDetector.hpp"
+#include "FrameGovernor.hpp"
+#include "FramePacer.hpp"
+#include "FrameRecorder.hpp"
+#include "GpuTimer.hpp"
+#include "PoseChannel.hpp"
+#include "ThreadPool.hpp"
 
 using namespace std;
 using namespace cv;
@@ -28,30 +40,397 @@ void processInput(GLFWwindow* window);
 
 const std::string calibrationFile = "C:/Users/Maloik/source/repos/VC-Assignment-3/src/cameraMatrix.yaml";
 
-tuple<Mat, Mat> getCalibration() {
-	const std::string path = calibrationFile;
-	if (!std::filesystem::exists(path)) {
-		std::cerr << "Camera calibration file not found: " << path << std::endl;
-		return tuple(Mat::ones(Size(4,4),1), Mat::ones(Size(4, 4), 1));
+// One capture source (camera device or replay file) with its own calibration, detection scratch and pose
+struct CameraStream {
+	CameraStream(const std::string& source, const std::string& calibrationPath, const cv::aruco::CharucoBoard& board,
+		const cv::aruco::DetectorParameters& detectorParams, const cv::aruco::CharucoParameters& charucoParams)
+		: source(source), calibrationPath(calibrationPath), fastDetector(board.getDictionary(), detectorParams),
+		arucoDetector(board.getDictionary(), detectorParams), charucoDetector(board, charucoParams, detectorParams) {
 	}
 
-	cv::FileStorage fs(path, cv::FileStorage::READ);
-	if (!fs.isOpened()) {
-		std::cerr << "Failed to open calibration file: " << path << std::endl;
-		return tuple(Mat::ones(Size(4, 4), 1), Mat::ones(Size(4, 4), 1));
+	std::string source;
+	std::string calibrationPath;
+	bool isReplay = false;
+	VideoCapture cap;
+	bool yuyvFrames = false;
+	Mat frame;
+	int64_t captureTimeNs = 0; // Device timestamp of the frame when the backend has one on poseClockNs(), otherwise when it was read
+	bool captureTimeFromDevice = false;
+	double frameTimestampMs = -1; // Backend timestamp of the last frame, tells new frames from repeated ones
+
+	Mat cameraMatrix, distortionCoefficients;
+	Mat undistortMap;
+	GLuint texture = 0;
+	GLuint undistortMapTexture = 0;
+
+	// Detectors and buffers, owned per stream so streams can be processed at the same time
+	FastMarkerDetector fastDetector;
+	cv::aruco::ArucoDetector arucoDetector;
+	cv::aruco::CharucoDetector charucoDetector;
+	Mat gray, undistortedGray, scaledGray;
+	vector<int> markerIds;
+	vector<vector<Point2f>> markerCorners;
+	Mat currentCharucoCorners, currentCharucoIds;
+	std::vector<cv::Point3f> objectPoints;
+	std::vector<cv::Point2f> imagePoints;
+
+	cv::Mat rvec, tvec;
+	bool poseIsValid = false;
+	float reprojectionError = -1;
+	double detectMs = 0;
+	bool grabbed = false;
+	glm::mat4 viewAR = glm::mat4(1.0f);
+
+	// For maintaining view of object on weak detection
+	cv::Mat lastValidCharucoCorners, lastValidCharucoIds;
+	cv::Mat lastValidRvec, lastValidTvec;
+	bool poseHasBeenFoundOnce = false;
+	double removeModelTimer = 0;
+
+	// Region around the board of the last frame, searched instead of the whole frame in between full detections
+	cv::Rect boardRegion;
+	bool boardRegionIsValid = false;
+	int framesSinceFullDetection = 0;
+
+	// Stats since the last report
+	int statFrames = 0;
+	int statNewFrames = 0;
+	int statPoses = 0;
+	double statDetectMs = 0;
+	double statLatencyMs = 0;
+	double statMaxLatencyMs = 0;
+};
+
+// Opens the capture, reads a first frame and loads the calibration of a stream
+bool openStream(CameraStream& stream, bool nativeCapture) {
+	// Plain numbers are camera devices, anything else is a recording to replay
+	stream.isReplay = stream.source.empty() ||
+		!std::all_of(stream.source.begin(), stream.source.end(), [](unsigned char c) { return std::isdigit(c); });
+	if (stream.isReplay) {
+		stream.cap.open(stream.source);
+	}
+	else {
+		int deviceID = std::stoi(stream.source);
+		int apiID = CAP_ANY;
+		stream.cap.open(deviceID, apiID);
+	}
+
+	if (!stream.cap.isOpened()) {
+		cerr << "ERROR! Unable to open camera " << stream.source << "\n";
+		return false;
+	}
+
+	// Ask for the camera's native YUYV stream instead of decoded BGR.
+	// Detection then runs on the luma plane and the shader does the colour conversion.
+	if (nativeCapture && !stream.isReplay) {
+		stream.cap.set(CAP_PROP_FOURCC, VideoWriter::fourcc('Y', 'U', 'Y', 'V'));
+		stream.cap.set(CAP_PROP_CONVERT_RGB, 0);
+	}
+
+	// Keep only the newest frame queued, older ones would only add latency. Not every backend supports it.
+	if (!stream.isReplay) {
+		stream.cap.set(CAP_PROP_BUFFERSIZE, 1);
+	}
+
+	// Get one frame from the camera to determine its size
+	stream.cap.read(stream.frame);
+	stream.yuyvFrames = nativeCapture && !stream.isReplay && stream.frame.type() == CV_8UC2;
+	if (nativeCapture && !stream.isReplay && !stream.yuyvFrames) {
+		// Backend ignored the request (MJPEG only or not V4L2), fall back to decoded BGR
+		cout << "Camera " << stream.source << " does not deliver raw YUYV, using BGR frames" << endl;
+		stream.cap.set(CAP_PROP_CONVERT_RGB, 1);
+		stream.cap.read(stream.frame);
 	}
+	if (stream.frame.empty()) {
+		cerr << "Error: couldn't capture an initial frame from " << stream.source << ".\n";
+		stream.cap.release();
+		return false;
+	}
+	if (!stream.yuyvFrames) {
+		flip(stream.frame, stream.frame, 0);
+	}
+
+	// Get calibration matrices, stop here rather than run with a missing or broken calibration
+	CameraCalibration calibration;
+	if (!loadCalibration(stream.calibrationPath, calibration)) {
+		cerr << "ERROR! No usable calibration for camera " << stream.source << "\n";
+		stream.cap.release();
+		return false;
+	}
+	// Frames at another resolution than the calibration get a scaled camera matrix
+	if (!cameraMatrixForSize(calibration, stream.frame.size(), stream.cameraMatrix)) {
+		cerr << "ERROR! Calibration does not fit camera " << stream.source << "\n";
+		stream.cap.release();
+		return false;
+	}
+	if (calibration.imageSize != Size() && calibration.imageSize != stream.frame.size()) {
+		cout << "Calibration of camera " << stream.source << " was made at " << calibration.imageSize
+			<< ", scaled to frames of " << stream.frame.size() << endl;
+	}
+	stream.distortionCoefficients = calibration.distortionCoefficients;
+
+	// Use the stored undistortion lookup when it was made for this frame size, otherwise build it once here
+	if (calibration.undistortMap.size() != stream.frame.size()) {
+		buildUndistortMap(calibration, stream.frame.size());
+	}
+	stream.undistortMap = calibration.undistortMap;
+	return true;
+}
+
+// Debug visuals for raw YUYV frames, which are only undistorted later in the shader. Corners and pose are in
+// undistorted coordinates, so they are distorted back onto the raw frame first. Drawing writes Y and one chroma
+// value shared by U and V, so the axes are magenta (x), green (y) and white (z).
+void drawOverlaysYuyv(CameraStream& stream) {
+	const Mat& K = stream.cameraMatrix;
+	const double fx = K.at<double>(0, 0), fy = K.at<double>(1, 1);
+	const double cx = K.at<double>(0, 2), cy = K.at<double>(1, 2);
+
+	const Mat& corners = stream.currentCharucoCorners;
+	if (!corners.empty()) {
+		std::vector<Point3f> rays;
+		for (int i = 0; i < (int)corners.total(); i++) {
+			Point2f c = corners.at<Point2f>(i);
+			rays.push_back(Point3f(float((c.x - cx) / fx), float((c.y - cy) / fy), 1.0f));
+		}
+		std::vector<Point2f> distorted;
+		cv::projectPoints(rays, Vec3d(), Vec3d(), K, stream.distortionCoefficients, distorted);
+		for (size_t i = 0; i < distorted.size(); i++) {
+			cv::rectangle(stream.frame, distorted[i] - Point2f(3, 3), distorted[i] + Point2f(3, 3), Scalar(235, 128), 1);
+			if (i < stream.currentCharucoIds.total()) {
+				cv::putText(stream.frame, "id=" + std::to_string(stream.currentCharucoIds.at<int>((int)i)),
+					distorted[i] + Point2f(5, -5), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(235, 128), 2);
+			}
+		}
+	}
+
+	const float length = 0.1f;
+	std::vector<Point3f> axes = { {0, 0, 0}, {length, 0, 0}, {0, length, 0}, {0, 0, length} };
+	std::vector<Point2f> projected;
+	cv::projectPoints(axes, stream.rvec, stream.tvec, K, stream.distortionCoefficients, projected);
+	cv::line(stream.frame, projected[0], projected[1], Scalar(105, 240), 3);
+	cv::line(stream.frame, projected[0], projected[2], Scalar(145, 16), 3);
+	cv::line(stream.frame, projected[0], projected[3], Scalar(235, 128), 3);
+}
 
-	cv::Mat cameraMatrix, distortionCoefficients;
-	fs["camera_matrix"] >> cameraMatrix;
-	fs["distortion_coefficients"] >> distortionCoefficients;
-	//fs["rvecs"] >> rvecs;
-	//fs["tvecs"] >> tvecs;
-	fs.release();
+// Refresh period of the monitor the window is on, 60 Hz when unknown
+double refreshPeriodOfWindow(GLFWwindow* window) {
+	GLFWmonitor* monitor = glfwGetWindowMonitor(window); // Only set in full screen
+	if (!monitor) {
+		// The monitor under the centre of the window
+		int x, y, width, height;
+		glfwGetWindowPos(window, &x, &y);
+		glfwGetWindowSize(window, &width, &height);
+		const int centerX = x + width / 2;
+		const int centerY = y + height / 2;
+		int count = 0;
+		GLFWmonitor** monitors = glfwGetMonitors(&count);
+		for (int i = 0; i < count && !monitor; i++) {
+			int monitorX, monitorY;
+			glfwGetMonitorPos(monitors[i], &monitorX, &monitorY);
+			const GLFWvidmode* mode = glfwGetVideoMode(monitors[i]);
+			if (mode && centerX >= monitorX && centerX < monitorX + mode->width && centerY >= monitorY && centerY < monitorY + mode->height) {
+				monitor = monitors[i];
+			}
+		}
+		if (!monitor) {
+			monitor = glfwGetPrimaryMonitor();
+		}
+	}
+	const GLFWvidmode* mode = monitor ? glfwGetVideoMode(monitor) : nullptr;
+	return 1.0 / (mode && mode->refreshRate > 0 ? mode->refreshRate : 60);
+}
 
-	return tuple(cameraMatrix, distortionCoefficients);
+// Waits for the next frame of a stream without decoding it, so the wait for the camera is kept apart
+// from the work on the frame. Runs on the detection pool.
+void grabStream(CameraStream& stream) {
+	stream.grabbed = stream.cap.grab();
+	if (!stream.grabbed && stream.isReplay) {
+		// Loop recordings
+		stream.cap.set(CAP_PROP_POS_FRAMES, 0);
+		stream.grabbed = stream.cap.grab();
+	}
+	stream.captureTimeNs = poseClockNs();
 }
 
-int main() {
+// Decodes the grabbed frame of a stream, detects the board and updates its pose. Runs on the detection pool.
+void processStream(CameraStream& stream, double deltaTime, double removeModelTimerMax, const cv::aruco::CharucoBoard& board,
+	bool fastFrontEnd, bool tiledDetection, const GovernorSettings& quality, ThreadPool& detectionPool) {
+	stream.poseIsValid = false;
+	stream.reprojectionError = -1;
+
+	if (!stream.grabbed || !stream.cap.retrieve(stream.frame)) {
+		stream.frame.release();
+	}
+	if (stream.frame.empty()) {
+		return;
+	}
+
+	// A frame is new when the backend timestamp moved on, backends without timestamps report 0 and count every read
+	double timestampMs = stream.cap.get(CAP_PROP_POS_MSEC);
+	if (timestampMs <= 0 || timestampMs != stream.frameTimestampMs) {
+		stream.statNewFrames++;
+	}
+	stream.frameTimestampMs = timestampMs;
+
+	// V4L2 stamps buffers on the monotonic clock that poseClockNs() reads on Linux, so the time spent in
+	// driver and USB buffers counts too. Other backends use their own clocks, their stamps are not plausible here.
+	const int64_t deviceTimeNs = (int64_t)(timestampMs * 1e6);
+	stream.captureTimeFromDevice = !stream.isReplay && timestampMs > 0 &&
+		deviceTimeNs <= stream.captureTimeNs && stream.captureTimeNs - deviceTimeNs < 1000000000;
+	if (stream.captureTimeFromDevice) {
+		stream.captureTimeNs = deviceTimeNs;
+	}
+
+	int64 detectStart = getTickCount();
+	if (stream.yuyvFrames) {
+		// Luma is every other byte of the packed frame, no colour conversion needed
+		cv::extractChannel(stream.frame, stream.gray, 0);
+		cv::remap(stream.gray, stream.undistortedGray, stream.undistortMap, noArray(), INTER_LINEAR);
+	}
+	else {
+		cv::Mat undistorted;
+		cv::remap(stream.frame, undistorted, stream.undistortMap, noArray(), INTER_LINEAR);
+		stream.frame = undistorted; // 47.5, 25, 22
+		cv::cvtColor(stream.frame, stream.undistortedGray, COLOR_BGR2GRAY);
+	}
+
+	// Search the whole frame periodically and whenever the board was lost, otherwise only around the last board
+	const cv::Rect fullFrame(0, 0, stream.undistortedGray.cols, stream.undistortedGray.rows);
+	bool fullDetection = !stream.boardRegionIsValid || ++stream.framesSinceFullDetection >= quality.fullDetectionInterval;
+	if (fullDetection) {
+		stream.framesSinceFullDetection = 0;
+	}
+	const cv::Rect region = fullDetection ? fullFrame : stream.boardRegion;
+
+	Mat detectionImage = stream.undistortedGray(region);
+	if (quality.detectionScale < 1.0) {
+		cv::resize(detectionImage, stream.scaledGray, Size(), quality.detectionScale, quality.detectionScale, INTER_AREA);
+		detectionImage = stream.scaledGray;
+	}
+
+	// Detect markers
+	if (fastFrontEnd) {
+		// Regions around the board are too small to be worth splitting into tiles
+		if (tiledDetection && fullDetection) {
+			stream.fastDetector.detectMarkersTiled(detectionImage, stream.markerCorners, stream.markerIds, detectionPool);
+		}
+		else {
+			stream.fastDetector.detectMarkers(detectionImage, stream.markerCorners, stream.markerIds);
+		}
+	}
+	else {
+		stream.arucoDetector.detectMarkers(detectionImage, stream.markerCorners, stream.markerIds);
+	}
+
+	// Back to full resolution frame coordinates
+	const float inverseScale = float(1.0 / quality.detectionScale);
+	for (auto& marker : stream.markerCorners) {
+		for (auto& corner : marker) {
+			corner.x = (corner.x + 0.5f) * inverseScale - 0.5f + region.x;
+			corner.y = (corner.y + 0.5f) * inverseScale - 0.5f + region.y;
+		}
+	}
+
+	// Interpolate the ChArUco corners on the full resolution frame.
+	// Empty markers would make detectBoard run the stock detector again.
+	stream.currentCharucoCorners = cv::Mat();
+	stream.currentCharucoIds = cv::Mat();
+	if (!stream.markerIds.empty()) {
+		stream.charucoDetector.detectBoard(stream.undistortedGray, stream.currentCharucoCorners, stream.currentCharucoIds,
+			stream.markerCorners, stream.markerIds);
+	}
+
+	if (stream.currentCharucoCorners.total() >= 6) {
+		board.matchImagePoints(stream.currentCharucoCorners, stream.currentCharucoIds, stream.objectPoints, stream.imagePoints);
+
+		if (stream.objectPoints.size() >= 6) {
+			// Corners come from the undistorted frame, so no distortion coefficients here
+			stream.poseIsValid = cv::solvePnP(stream.objectPoints, stream.imagePoints, stream.cameraMatrix,
+				noArray(), stream.rvec, stream.tvec);
+			if (stream.poseIsValid) {
+				std::vector<cv::Point2f> projected;
+				cv::projectPoints(stream.objectPoints, stream.rvec, stream.tvec, stream.cameraMatrix, noArray(), projected);
+				stream.reprojectionError = (float)(cv::norm(stream.imagePoints, projected, NORM_L2) / std::sqrt((double)projected.size()));
+
+				stream.lastValidCharucoCorners = stream.currentCharucoCorners.clone();
+				stream.lastValidCharucoIds = stream.currentCharucoIds.clone();
+				stream.lastValidRvec = stream.rvec.clone();
+				stream.lastValidTvec = stream.tvec.clone();
+				stream.poseHasBeenFoundOnce = true;
+				stream.removeModelTimer = removeModelTimerMax;
+			}
+		}
+	}
+
+	// Next frame searches around the markers of this one
+	stream.boardRegionIsValid = false;
+	if (stream.poseIsValid) {
+		std::vector<cv::Point2f> markerPoints;
+		for (const auto& marker : stream.markerCorners) {
+			markerPoints.insert(markerPoints.end(), marker.begin(), marker.end());
+		}
+		cv::Rect bounds = cv::boundingRect(markerPoints);
+		int margin = (int)std::ceil(quality.roiMargin * std::max(bounds.width, bounds.height));
+		stream.boardRegion = Rect(bounds.x - margin, bounds.y - margin, bounds.width + 2 * margin, bounds.height + 2 * margin) & fullFrame;
+		stream.boardRegionIsValid = !stream.boardRegion.empty();
+	}
+	stream.detectMs = double(getTickCount() - detectStart) * 1000.0 / getTickFrequency();
+	stream.statDetectMs += stream.detectMs;
+	stream.statFrames++;
+	stream.statPoses += stream.poseIsValid ? 1 : 0;
+
+	// Fallback to previous position for lapses in detection
+	if (!stream.poseIsValid && stream.poseHasBeenFoundOnce) {
+		stream.currentCharucoCorners = stream.lastValidCharucoCorners.clone();
+		stream.currentCharucoIds = stream.lastValidCharucoIds.clone();
+		stream.rvec = stream.lastValidRvec.clone();
+		stream.tvec = stream.lastValidTvec.clone();
+		stream.removeModelTimer -= deltaTime;
+	}
+
+	if (stream.removeModelTimer <= 0) {
+		stream.poseHasBeenFoundOnce = false;
+	}
+
+	if (stream.poseIsValid || stream.poseHasBeenFoundOnce) {
+		// Draw debug visuals on frame
+		if (stream.yuyvFrames) {
+			drawOverlaysYuyv(stream);
+		}
+		else {
+			cv::aruco::drawDetectedCornersCharuco(stream.frame, stream.currentCharucoCorners, stream.currentCharucoIds);
+			cv::drawFrameAxes(stream.frame, stream.cameraMatrix, noArray(), stream.rvec, stream.tvec, 0.1f);
+		}
+
+		// Turn 3D rotationVector into 3x3 matrix
+		Mat rotationMatrix;
+		cv::Rodrigues(stream.rvec, rotationMatrix);
+
+		// Convert OpenCV coordinate system to OpenGL coordinate system
+		cv::Mat tvecCopy = stream.tvec.clone();
+		cv::Mat rotCopy = rotationMatrix.clone();
+
+		tvecCopy.at<double>(1) *= -1;
+		tvecCopy.at<double>(2) *= -1;
+		rotCopy.row(1) *= -1;
+		rotCopy.row(2) *= -1;
+
+		// Build view matrix
+		cv::Mat newView = cv::Mat::zeros(4, 4, CV_64F);
+		rotCopy.copyTo(newView(cv::Rect(0, 0, 3, 3)));
+		newView.at<double>(3, 3) = 1.0;
+		tvecCopy.copyTo(newView(cv::Rect(3, 0, 1, 3)));
+
+		// Convert to glm
+		for (int r = 0; r < 4; ++r) {
+			for (int c = 0; c < 4; ++c) {
+				stream.viewAR[c][r] = (float)newView.at<double>(r, c);
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
 	if (!glfwInit()) { // Check that glfw works
 		return -1;
 	}
@@ -103,8 +482,27 @@ int main() {
 		"in vec3 color;\n"
 		"in vec2 texCoord;\n"
 		"uniform sampler2D tex0;\n" // Which texture unit for OpenGL to use
+		"uniform sampler2D undistortMap;\n" // Destination -> source pixel lookup (RG32F)
+		"uniform int yuyvMode;\n" // 1 when tex0 holds a raw YUYV camera frame
 		"void main() {\n"
-		"    fragColor = texture(tex0,texCoord);\n" //RGBA output
+		"    if (yuyvMode == 1) {\n"
+		// Undistort by looking up the source pixel, image row 0 is the top of the plane
+		"        vec2 src = texture(undistortMap, vec2(texCoord.x, 1.0 - texCoord.y)).rg;\n"
+		"        ivec2 size = textureSize(tex0, 0);\n"
+		"        ivec2 p = ivec2(floor(src + 0.5));\n"
+		"        if (p.x < 0 || p.y < 0 || p.x >= size.x || p.y >= size.y) {\n"
+		"            fragColor = vec4(0.0, 0.0, 0.0, 1.0);\n"
+		"            return;\n"
+		"        }\n"
+		// Y is in R for every pixel, U and V alternate in G for each pixel pair
+		"        int pair = p.x - (p.x % 2);\n"
+		"        float y = 1.164 * (texelFetch(tex0, p, 0).r - 0.0625);\n"
+		"        float u = texelFetch(tex0, ivec2(pair, p.y), 0).g - 0.5;\n"
+		"        float v = texelFetch(tex0, ivec2(pair + 1, p.y), 0).g - 0.5;\n"
+		"        fragColor = vec4(y + 1.596 * v, y - 0.391 * u - 0.813 * v, y + 2.018 * u, 1.0);\n" // BT.601
+		"    } else {\n"
+		"        fragColor = texture(tex0,texCoord);\n" //RGBA output
+		"    }\n"
 		"}\0";
 
 	unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER); // Create empty vertex shader
@@ -305,57 +703,6 @@ int main() {
 	glBindTexture(GL_TEXTURE_2D, 0);
 
 
-	// Texture 2
-
-	Mat frame;
-	VideoCapture cap;
-
-	int deviceID = 0;
-	int apiID = CAP_ANY;
-	cap.open(deviceID, apiID);
-
-	if (!cap.isOpened()) {
-		cerr << "ERROR! Unable to open camera\n";
-		return -1;
-	}
-
-	// Get one frame from the camera to determine its size
-	cap.read(frame);
-	flip(frame, frame, 0);
-	if (frame.empty()) {
-		cerr << "Error: couldn't capture an initial frame from camera. Exiting.\n";
-		cap.release();
-		return -1;
-	}
-	float videoAspectRatio = (float)frame.cols / (float)frame.rows;
-
-	window_width = frame.cols;
-	window_height = frame.rows;
-	glfwSetWindowSize(window, window_width, window_height);
-
-	GLuint texture_2;
-	glGenTextures(1, &texture_2);
-
-	// Make texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, texture_2);
-
-	// Adjust texture settings
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // Scale with nearest neighbour
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); // Repeat image on x axis
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT); // Repeat image on y axis
-
-	// Generate image - texture type, 0, colour channels, width, height, 0, colour channels, data type of pixels, data itself
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frame.cols, frame.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, frame.data); //RGBA for pngs, RGB for jpegs
-
-	glGenerateMipmap(GL_TEXTURE_2D); // Generate smaller resolutions of the image for far distance
-
-	// Free up resources
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-
-
 	// Initialize detector
 	int squareHorizontal = 5;
 	int squareVertical = 7;
@@ -367,44 +714,169 @@ int main() {
 	cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(dictionaryId);
 	cv::aruco::CharucoBoard board(cv::Size(squareHorizontal, squareVertical), squareLength, markerLength, dictionary);
 
-	// Create detectors
+	// Lowers detection quality when the work of a frame does not fit in the frame time, and raises it again when it does
+	const bool adaptiveQuality = true;
+	const double targetFrameMs = 1000.0 / 60.0;
+	FrameGovernor governor(targetFrameMs);
+
+	// Detector settings, every stream creates its own detectors from them
 	cv::aruco::DetectorParameters detectorParams;
+	if (adaptiveQuality) {
+		detectorParams.adaptiveThreshWinSizeStep = governor.settings().thresholdWinSizeStep;
+		detectorParams.cornerRefinementMethod = governor.settings().cornerRefinementMethod;
+	}
 	cv::aruco::CharucoParameters charucoParams;
-	cv::aruco::CharucoDetector charucoDetector(board, charucoParams, detectorParams);
 
+	// Single pass threshold and decoder for our dictionary, its markers feed the ChArUco interpolation
+	const bool fastFrontEnd = true;
+
+	// Split detection into tiles over all cores
+	const bool tiledDetection = true;
+
+	// Streams and their tiles are all scheduled on this pool
+	ThreadPool detectionPool;
+
+
+	// Texture 2 - one camera plane per stream
+
+	// Sources are given as device number or replay file, optionally followed by =calibrationFile
+	// e.g. App 0 1=cameraMatrix1.yaml recording.mp4=cameraMatrix2.yaml
+	// --record <file> records the composited output (.avi, .mp4 or raw .y4m)
+	// --publish <name> publishes every pose to the POSIX shared memory ring <name>, e.g. /vc_pose
+	// --late-pacing turns on vsync and starts every frame as late as it can still make the next vsync
+	const bool nativeCapture = true;
+	std::vector<std::unique_ptr<CameraStream>> streams;
+	std::vector<std::string> sources;
+	std::string recordPath;
+	std::string publishName;
+	bool latePacing = false;
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		if (argument == "--record" && i + 1 < argc) {
+			recordPath = argv[++i];
+		}
+		else if (argument == "--publish" && i + 1 < argc) {
+			publishName = argv[++i];
+		}
+		else if (argument == "--late-pacing") {
+			latePacing = true;
+		}
+		else {
+			sources.push_back(argument);
+		}
+	}
+	if (sources.empty()) {
+		sources.push_back("0");
+	}
+	for (const auto& argument : sources) {
+		size_t separator = argument.find('=');
+		std::string source = argument.substr(0, separator);
+		std::string calibrationPath = separator == std::string::npos ? calibrationFile : argument.substr(separator + 1);
+
+		streams.push_back(std::make_unique<CameraStream>(source, calibrationPath, board, detectorParams, charucoParams));
+		if (!openStream(*streams.back(), nativeCapture)) {
+			return -1;
+		}
+	}
 
-	// Get calibration matrices
-	auto [cameraMatrix, distortionCoefficients] = getCalibration();
-	double fx = cameraMatrix.at<double>(0, 0); // Focal length in px
-	double fy = cameraMatrix.at<double>(1, 1);
-	double cx = cameraMatrix.at<double>(0, 2); // Principle point
-	double cy = cameraMatrix.at<double>(1, 2);
+	// Poses for other processes on this machine, see PoseChannel.hpp for the reader side
+	PosePublisher posePublisher;
+	if (!publishName.empty() && !posePublisher.open(publishName)) {
+		return -1;
+	}
 
-	float rotation = 0.0f;
-	double previousTime = glfwGetTime();
+	// Streams are composited into a grid, every cell keeps the aspect ratio of the first stream
+	const int gridCols = (int)std::ceil(std::sqrt((double)streams.size()));
+	const int gridRows = ((int)streams.size() + gridCols - 1) / gridCols;
+	const Mat& firstFrame = streams[0]->frame;
+	float videoAspectRatio = (float)firstFrame.cols / (float)firstFrame.rows;
 
-	cv::Mat rvec, tvec;
-	std::vector<cv::Point3f> objectPoints;
-	std::vector<cv::Point2f> imagePoints;
+	window_width = firstFrame.cols;
+	window_height = firstFrame.rows * gridRows / gridCols;
+	glfwSetWindowSize(window, window_width, window_height);
 
-	Mat currentCharucoCorners, currentCharucoIds;
-	vector<int> markerIds;
-	vector<vector<Point2f>> markerCorners;
-	vector<Point3f> currentObjectPoints;
-	vector<Point2f> currentImagePoints;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Camera rows are tightly packed
+	for (auto& stream : streams) {
+		glGenTextures(1, &stream->texture);
+
+		// Make texture unit
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, stream->texture);
+
+		// Adjust texture settings
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // Scale with nearest neighbour
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); // Repeat image on x axis
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT); // Repeat image on y axis
+
+		// Generate image - texture type, 0, colour channels, width, height, 0, colour channels, data type of pixels, data itself
+		const Mat& frame = stream->frame;
+		if (stream->yuyvFrames) {
+			// Raw YUYV, 2 bytes per pixel: Y in R and alternating U/V in G
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, frame.cols, frame.rows, 0, GL_RG, GL_UNSIGNED_BYTE, frame.data);
+		}
+		else {
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frame.cols, frame.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, frame.data); //RGBA for pngs, RGB for jpegs
+			glGenerateMipmap(GL_TEXTURE_2D); // Generate smaller resolutions of the image for far distance
+		}
 
-	// For maintaining view of object on weak detection
-	cv::Mat lastValidCharucoCorners, lastValidCharucoIds;
-	cv::Mat lastValidRvec, lastValidTvec;
-	bool poseHasBeenFoundOnce = false;
+		// Free up resources
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// Texture 3 - the undistortion lookup for the shader to undistort raw YUYV frames
+		const Mat& undistortMap = stream->undistortMap;
+		glGenTextures(1, &stream->undistortMapTexture);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, stream->undistortMapTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, undistortMap.cols, undistortMap.rows, 0, GL_RG, GL_FLOAT, undistortMap.data);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	GLuint undistortMapUniform = glGetUniformLocation(shaderProgram, "undistortMap");
+	GLuint yuyvModeUniform = glGetUniformLocation(shaderProgram, "yuyvMode");
+
+	float rotation = 0.0f;
+	double previousTime = glfwGetTime();
 
 	double lastFrameTime = glfwGetTime();
 	double startTime = lastFrameTime;
 	double removeModelTimerMax = 2; // seconds
-	double removeModelTimer = removeModelTimerMax;
+
+	// Reads back what is rendered and encodes it in the background, created once the window has its final size.
+	// Frames are taken at this rate whatever the render rate.
+	std::unique_ptr<FrameRecorder> recorder;
+	const double recordFps = 30.0;
+
+	// Stats are reported once per interval
+	const double statsInterval = 1.0; // seconds
+	double lastStatsTime = lastFrameTime;
+	int statFrames = 0;
+
+	// GPU time of the camera planes and of the models, results are picked up a few frames late so nothing waits on the GPU
+	std::unique_ptr<GpuTimer> cameraPassTimer = std::make_unique<GpuTimer>();
+	std::unique_ptr<GpuTimer> modelPassTimer = std::make_unique<GpuTimer>();
+
+	// Late pacing: with vsync on, wait after each swap and only then read the cameras, so the frame shown
+	// at the next vsync is as new as possible
+	std::unique_ptr<FramePacer> pacer;
+	if (latePacing) {
+		glfwSwapInterval(1);
+		pacer = std::make_unique<FramePacer>(refreshPeriodOfWindow(window));
+	}
+	double statPacingWait = 0;
+	double statCaptureWait = 0;
 
 	//glEnable(GL_DEPTH_TEST);
 	while (!glfwWindowShouldClose(window)) {
+		if (pacer) {
+			statPacingWait += pacer->waitForFrameStart();
+		}
+
 		processInput(window);
 
 		glClearColor(0.6f, 0.0f, 0.0f, 1.0f);
@@ -412,130 +884,187 @@ int main() {
 
 		glUseProgram(shaderProgram);
 		glUniform1i(tex0Uniform, 0);
+		glUniform1i(undistortMapUniform, 1);
 
 		double currentTime = glfwGetTime();
 		double deltaTime = currentTime - lastFrameTime;
 		lastFrameTime = currentTime;
 
-		double fps = 1.0 / deltaTime;
-		std::cout << "FPS: " << fps << std::endl;
-
-		cap.read(frame);
-
-		cv::Mat undistorted;
-		cv::undistort(frame, undistorted, cameraMatrix, distortionCoefficients);
-		frame = undistorted; // 47.5, 25, 22
-
-		// Detect CharucoBoard
-		currentCharucoCorners = cv::Mat();
-		currentCharucoIds = cv::Mat();
-		charucoDetector.detectBoard(frame, currentCharucoCorners, currentCharucoIds);
-
-		bool poseIsValid = false;
-
-		if (currentCharucoCorners.total() >= 6) {
-			board.matchImagePoints(currentCharucoCorners, currentCharucoIds, objectPoints, imagePoints);
-
-			if (objectPoints.size() >= 6) {
-				poseIsValid = cv::solvePnP(objectPoints, imagePoints, cameraMatrix, distortionCoefficients, rvec, tvec);
-				if (poseIsValid) {
-					lastValidCharucoCorners = currentCharucoCorners.clone();
-					lastValidCharucoIds = currentCharucoIds.clone();
-					lastValidRvec = rvec.clone();
-					lastValidTvec = tvec.clone();
-					poseHasBeenFoundOnce = true;
-					removeModelTimer = removeModelTimerMax;
-				}
+		statFrames++;
+		if (currentTime - lastStatsTime >= statsInterval) {
+			double elapsed = currentTime - lastStatsTime;
+			std::cout << "FPS: " << statFrames / elapsed << std::endl;
+			for (auto& stream : streams) {
+				int frames = std::max(stream->statFrames, 1);
+				std::cout << "  [" << stream->source << "] capture FPS: " << stream->statNewFrames / elapsed
+					<< ", processed FPS: " << stream->statFrames / elapsed
+					<< ", detection: " << stream->statDetectMs / frames << " ms"
+					<< ", pose found: " << 100 * stream->statPoses / frames << "%"
+					<< (stream->captureTimeFromDevice ? ", capture to display: " : ", read to display: ")
+					<< stream->statLatencyMs / frames << " ms (max "
+					<< stream->statMaxLatencyMs << " ms)" << std::endl;
+				stream->statFrames = 0;
+				stream->statNewFrames = 0;
+				stream->statPoses = 0;
+				stream->statDetectMs = 0;
+				stream->statLatencyMs = 0;
+				stream->statMaxLatencyMs = 0;
 			}
+			std::cout << "  GPU: camera planes " << cameraPassTimer->takeAverageMs() << " ms, models "
+				<< modelPassTimer->takeAverageMs() << " ms (-1: no result yet)" << std::endl;
+			if (pacer) {
+				std::cout << "  pacing: waited " << statPacingWait * 1000.0 / statFrames << " ms per frame, camera wait "
+					<< statCaptureWait * 1000.0 / statFrames << " ms, predicted work "
+					<< pacer->predictedWork() * 1000.0 << " ms, refresh " << pacer->refreshPeriod() * 1000.0 << " ms" << std::endl;
+
+				// The window may have moved to another monitor
+				pacer->setRefreshPeriod(refreshPeriodOfWindow(window));
+			}
+			statPacingWait = 0;
+			statCaptureWait = 0;
+			if (recorder) {
+				std::cout << "  recording: " << recorder->recordedFrames() << " frames, "
+					<< recorder->droppedFrames() << " dropped" << std::endl;
+			}
+			if (adaptiveQuality) {
+				const GovernorSettings& quality = governor.settings();
+				std::cout << "  governor: level " << governor.level() << ", work " << governor.smoothedWorkMs()
+					<< " / " << governor.targetMs() << " ms, scale " << quality.detectionScale
+					<< ", full detection every " << quality.fullDetectionInterval << " frames" << std::endl;
+			}
+			statFrames = 0;
+			lastStatsTime = currentTime;
 		}
 
-		// Fallback to previous position for lapses in detection
-		if (!poseIsValid && poseHasBeenFoundOnce) {
-			currentCharucoCorners = lastValidCharucoCorners.clone();
-			currentCharucoIds = lastValidCharucoIds.clone();
-			rvec = lastValidRvec.clone();
-			tvec = lastValidTvec.clone();
-			removeModelTimer -= deltaTime;
-		}
-
-		if (removeModelTimer <= 0) {
-			poseHasBeenFoundOnce = false;
+		// Capture, detection and pose estimation of every stream run concurrently on the pool.
+		// The wait for camera frames is measured on its own, it is not work the pacer has to leave time for.
+		const GovernorSettings& quality = governor.settings();
+		double captureStart = glfwGetTime();
+		detectionPool.parallelFor((int)streams.size(), [&](int i) {
+			grabStream(*streams[i]);
+		});
+		double captureWait = glfwGetTime() - captureStart;
+		statCaptureWait += captureWait;
+		detectionPool.parallelFor((int)streams.size(), [&](int i) {
+			processStream(*streams[i], deltaTime, removeModelTimerMax, board,
+				fastFrontEnd, tiledDetection, quality, detectionPool);
+		});
+		int64 renderStart = getTickCount();
+
+		// The slowest stream sets the detection time, waiting for the camera is not work the governor can save
+		double detectionMs = 0;
+		for (auto& stream : streams) {
+			if (!stream->frame.empty()) detectionMs = std::max(detectionMs, stream->detectMs);
 		}
 
-		glm::mat4 viewAR(1.0f);
-		if (poseIsValid || poseHasBeenFoundOnce) {
-			// Draw debug visuals on frame
-			cv::aruco::drawDetectedCornersCharuco(frame, currentCharucoCorners, currentCharucoIds);
-			cv::drawFrameAxes(frame, cameraMatrix, distortionCoefficients, rvec, tvec, 0.1f);
-
-			// Turn 3D rotationVector into 3x3 matrix
-			Mat rotationMatrix;
-			cv::Rodrigues(rvec, rotationMatrix);
-
-			// Convert OpenCV coordinate system to OpenGL coordinate system
-			cv::Mat tvecCopy = tvec.clone();
-			cv::Mat rotCopy = rotationMatrix.clone();
-
-			tvecCopy.at<double>(1) *= -1;
-			tvecCopy.at<double>(2) *= -1;
-			rotCopy.row(1) *= -1;
-			rotCopy.row(2) *= -1;
-
-			// Build view matrix
-			cv::Mat newView = cv::Mat::zeros(4, 4, CV_64F);
-			rotCopy.copyTo(newView(cv::Rect(0, 0, 3, 3)));
-			newView.at<double>(3, 3) = 1.0;
-			tvecCopy.copyTo(newView(cv::Rect(3, 0, 1, 3)));
-
-			// Convert to glm
-			for (int r = 0; r < 4; ++r) {
-				for (int c = 0; c < 4; ++c) {
-					viewAR[c][r] = (float)newView.at<double>(r, c);
+		if (posePublisher.isOpen()) {
+			for (size_t i = 0; i < streams.size(); i++) {
+				const CameraStream& stream = *streams[i];
+				if (stream.frame.empty()) continue;
+
+				PoseSample sample;
+				sample.captureTimeNs = stream.captureTimeNs;
+				sample.streamIndex = (uint32_t)i;
+				sample.reprojectionError = stream.reprojectionError;
+				sample.detectionMs = (float)stream.detectMs;
+				sample.markerCount = (uint32_t)stream.markerIds.size();
+				if (stream.poseIsValid || stream.poseHasBeenFoundOnce) {
+					sample.flags = stream.poseIsValid ? PoseSample::PoseValid : PoseSample::PoseHeld;
+					for (int k = 0; k < 3; k++) {
+						sample.rvec[k] = stream.rvec.at<double>(k);
+						sample.tvec[k] = stream.tvec.at<double>(k);
+					}
+					std::copy(glm::value_ptr(stream.viewAR), glm::value_ptr(stream.viewAR) + 16, sample.viewAR);
+					const Mat& ids = stream.currentCharucoIds;
+					sample.cornerCount = (uint32_t)std::min<size_t>(ids.total(), PoseSample::maxCorners);
+					for (uint32_t k = 0; k < sample.cornerCount; k++) {
+						sample.cornerIds[k] = ids.at<int>((int)k);
+					}
 				}
+				posePublisher.publish(sample);
 			}
 		}
 
-		if (!frame.empty()) {
-			flip(frame, frame, 0);
-			glBindTexture(GL_TEXTURE_2D, texture_2);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frame.cols, frame.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, frame.data);
-			glBindTexture(GL_TEXTURE_2D, 0);
-		}
-
-		glDisable(GL_DEPTH_TEST);
-
 		int viewLoc = glGetUniformLocation(shaderProgram, "view");
 		int projectionLoc = glGetUniformLocation(shaderProgram, "projection");
 		int modelLoc = glGetUniformLocation(shaderProgram, "model");
 
-		glm::mat4 identityMat = glm::mat4(1.0f);
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(identityMat));
-		glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(identityMat));
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(identityMat));
+		const int cellWidth = window_width / gridCols;
+		const int cellHeight = window_height / gridRows;
+		auto setCellViewport = [&](size_t i) {
+			// Grid cell of this stream, row 0 at the top of the window
+			int col = (int)i % gridCols;
+			int row = (int)i / gridCols;
+			glViewport(col * cellWidth, window_height - (row + 1) * cellHeight, cellWidth, cellHeight);
+		};
+
+		// Camera pass, the planes never overlap so no depth test is needed
+		cameraPassTimer->begin();
+		glDisable(GL_DEPTH_TEST);
+		for (size_t i = 0; i < streams.size(); i++) {
+			CameraStream& stream = *streams[i];
+			Mat& frame = stream.frame;
+
+			if (!frame.empty()) {
+				glBindTexture(GL_TEXTURE_2D, stream.texture);
+				if (stream.yuyvFrames) {
+					glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame.cols, frame.rows, GL_RG, GL_UNSIGNED_BYTE, frame.data);
+				}
+				else {
+					flip(frame, frame, 0);
+					glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frame.cols, frame.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, frame.data);
+				}
+				glBindTexture(GL_TEXTURE_2D, 0);
+			}
+
+			setCellViewport(i);
+
+			glm::mat4 identityMat = glm::mat4(1.0f);
+			glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(identityMat));
+			glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(identityMat));
+			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(identityMat));
+
+			glUniform1f(uniID, 1.0f);
+			glUniform1i(yuyvModeUniform, stream.yuyvFrames ? 1 : 0);
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, stream.undistortMapTexture);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, stream.texture);
+			glBindVertexArray(VAO_PLANE);
+			glDrawElements(GL_TRIANGLES, sizeof(quadIndices) / sizeof(int), GL_UNSIGNED_INT, 0);
+		}
+		cameraPassTimer->end();
 
-		glUniform1f(uniID, 1.0f);
-		glBindTexture(GL_TEXTURE_2D, texture_2);
-		glBindVertexArray(VAO_PLANE);
-		glDrawElements(GL_TRIANGLES, sizeof(quadIndices) / sizeof(int), GL_UNSIGNED_INT, 0);
+		// Model pass, the planes wrote no depth so the clear at the top of the frame serves every cell
+		modelPassTimer->begin();
+		glEnable(GL_DEPTH_TEST);
+		for (size_t i = 0; i < streams.size(); i++) {
+			CameraStream& stream = *streams[i];
+			if (!stream.poseIsValid && !stream.poseHasBeenFoundOnce) continue;
 
-		if (poseIsValid || poseHasBeenFoundOnce) {
-			glEnable(GL_DEPTH_TEST);
-			glClear(GL_DEPTH_BUFFER_BIT);
+			setCellViewport(i);
 
 			// Create projection matrix
 			double near = 0.01;
 			double far = 10.0;
 
+			double fx = stream.cameraMatrix.at<double>(0, 0); // Focal length in px
+			double fy = stream.cameraMatrix.at<double>(1, 1);
+			double cx = stream.cameraMatrix.at<double>(0, 2); // Principle point
+			double cy = stream.cameraMatrix.at<double>(1, 2);
+			const int imageWidth = stream.undistortMap.cols;
+			const int imageHeight = stream.undistortMap.rows;
+
 			glm::mat4 projectionAR = glm::mat4(0.0f);
-			projectionAR[0][0] = 2.0f * fx / frame.cols;
-			projectionAR[1][1] = 2.0f * fy / frame.rows;
-			projectionAR[2][0] = 1.0f - 2.0f * cx / frame.cols;
-			projectionAR[2][1] = -1.0f + (2.0f * cy + 2.0f) / frame.rows;
+			projectionAR[0][0] = 2.0f * fx / imageWidth;
+			projectionAR[1][1] = 2.0f * fy / imageHeight;
+			projectionAR[2][0] = 1.0f - 2.0f * cx / imageWidth;
+			projectionAR[2][1] = -1.0f + (2.0f * cy + 2.0f) / imageHeight;
 			projectionAR[2][2] = (near + far) / (near - far);
 			projectionAR[2][3] = -1.0f;
 			projectionAR[3][2] = 2.0f * near * far / (near - far);
 
-			glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(viewAR));
+			glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(stream.viewAR));
 			glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projectionAR));
 
 			// Centering
@@ -550,20 +1079,92 @@ int main() {
 			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(cubeModel));
 
 			glUniform1f(uniID, 0.15f);
+			glUniform1i(yuyvModeUniform, 0);
 			glBindTexture(GL_TEXTURE_2D, texture);
 			glBindVertexArray(VAO);
 			glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(int), GL_UNSIGNED_INT, 0);
 		}
+		glDisable(GL_DEPTH_TEST);
+		modelPassTimer->end();
+		glViewport(0, 0, window_width, window_height);
+
+		if (!recordPath.empty()) {
+			int framebufferWidth, framebufferHeight;
+			glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+			if (!recorder) {
+				recorder = std::make_unique<FrameRecorder>(recordPath, framebufferWidth, framebufferHeight, recordFps);
+				glfwSetWindowAttrib(window, GLFW_RESIZABLE, GLFW_FALSE); // A recording keeps one frame size
+			}
+			if (!recorder->isOpen()) {
+				// The recorder reported why, carry on without recording
+				recorder.reset();
+				recordPath.clear();
+				glfwSetWindowAttrib(window, GLFW_RESIZABLE, GLFW_TRUE);
+			}
+			else if (framebufferWidth != recorder->frameWidth() || framebufferHeight != recorder->frameHeight()) {
+				// Resized anyway (e.g. moved to a monitor with another scale), end the file rather than write broken frames
+				std::cerr << "Window resized while recording, recording stopped: " << recordPath << std::endl;
+				recorder.reset();
+				recordPath.clear();
+				glfwSetWindowAttrib(window, GLFW_RESIZABLE, GLFW_TRUE);
+			}
+			else {
+				recorder->capture(currentTime);
+			}
+		}
+
+		// Everything up to here but the camera wait is work of this frame, the swap only waits for the display
+		double workMs = (glfwGetTime() - currentTime - captureWait) * 1000.0;
+		if (pacer) {
+			double gpuMs = std::max(cameraPassTimer->latestMs(), 0.0) + std::max(modelPassTimer->latestMs(), 0.0);
+			pacer->frameDone((workMs + gpuMs) / 1000.0);
+		}
+		if (adaptiveQuality) {
+			double renderMs = double(getTickCount() - renderStart) * 1000.0 / getTickFrequency();
+			if (governor.update(detectionMs + renderMs, detectionMs, renderMs)) {
+				std::cout << governor.lastDecision() << std::endl;
+
+				// Only change detectors here, while no stream is being processed
+				detectorParams.adaptiveThreshWinSizeStep = governor.settings().thresholdWinSizeStep;
+				detectorParams.cornerRefinementMethod = governor.settings().cornerRefinementMethod;
+				for (auto& stream : streams) {
+					stream->fastDetector.setDetectorParameters(detectorParams);
+					stream->arucoDetector.setDetectorParameters(detectorParams);
+					stream->charucoDetector.setDetectorParameters(detectorParams);
+				}
+			}
+		}
 
 		glfwSwapBuffers(window);
+		if (pacer) {
+			pacer->swapped();
+		}
+
+		// Display time is taken as the swap return, drivers that queue frames show them a little later
+		int64_t displayTimeNs = poseClockNs();
+		for (auto& stream : streams) {
+			if (stream->frame.empty()) continue;
+			double latencyMs = double(displayTimeNs - stream->captureTimeNs) / 1e6;
+			stream->statLatencyMs += latencyMs;
+			stream->statMaxLatencyMs = std::max(stream->statMaxLatencyMs, latencyMs);
+		}
+
 		glfwPollEvents();
 	}
 
 	// Free resources
+	recorder.reset(); // Flushes the last frames, needs the GL context
+	pacer.reset();
+	cameraPassTimer.reset();
+	modelPassTimer.reset();
 	glDeleteProgram(shaderProgram);
 	glDeleteBuffers(1, &VBO);
 	glDeleteVertexArrays(1, &VAO);
 	glDeleteTextures(1, &texture);
+	for (auto& stream : streams) {
+		glDeleteTextures(1, &stream->texture);
+		glDeleteTextures(1, &stream->undistortMapTexture);
+	}
 
 	glfwTerminate();
 	return 0;
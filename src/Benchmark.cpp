@@ -0,0 +1,378 @@
+#include <opencv2/opencv.hpp>
+#include <opencv2/objdetect/aruco_detector.hpp>
+#include <opencv2/objdetect/charuco_detector.hpp>
+#include <iostream>
+#include <vector>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include "FastMarkerDetector.hpp"
+#include "MarkerCodeTable.hpp"
+#include "ThreadPool.hpp"
+
+// Mean wall time of one call in milliseconds
+double timeMs(const std::function<void()>& f, int iterations) {
+    f(); // Warm up caches and scratch buffers
+    int64 start = cv::getTickCount();
+    for (int i = 0; i < iterations; i++) {
+        f();
+    }
+    return double(cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency() / iterations;
+}
+
+// Board seen from random viewpoints on a cluttered background, deterministic for a given seed
+std::vector<cv::Mat> makeSyntheticFrames(const cv::aruco::CharucoBoard& board, int count) {
+    cv::Mat boardImage;
+    board.generateImage(cv::Size(500, 700), boardImage, 20, 1);
+
+    cv::RNG rng(1234);
+    std::vector<cv::Mat> frames;
+    for (int i = 0; i < count; i++) {
+        cv::Mat frame(720, 1280, CV_8UC1);
+        rng.fill(frame, cv::RNG::UNIFORM, 60, 200);
+        cv::GaussianBlur(frame, frame, cv::Size(9, 9), 3);
+
+        // Dark rectangles produce quads that are not markers
+        for (int j = 0; j < 60; j++) {
+            cv::Point p(rng.uniform(0, frame.cols), rng.uniform(0, frame.rows));
+            cv::Size s(rng.uniform(10, 80), rng.uniform(10, 80));
+            cv::rectangle(frame, cv::Rect(p, s), cv::Scalar(rng.uniform(0, 60)), cv::FILLED);
+        }
+
+        float cx = float(rng.uniform(350, 930));
+        float cy = float(rng.uniform(250, 470));
+        float halfWidth = float(rng.uniform(120, 200));
+        float halfHeight = halfWidth * 1.4f;
+        std::vector<cv::Point2f> src = {
+            {0, 0}, {float(boardImage.cols), 0}, {float(boardImage.cols), float(boardImage.rows)}, {0, float(boardImage.rows)} };
+        std::vector<cv::Point2f> dst;
+        for (int c = 0; c < 4; c++) {
+            float sx = (c == 1 || c == 2) ? 1.0f : -1.0f;
+            float sy = (c >= 2) ? 1.0f : -1.0f;
+            dst.push_back(cv::Point2f(cx + sx * halfWidth + float(rng.uniform(-40, 40)),
+                cy + sy * halfHeight * 0.5f + float(rng.uniform(-40, 40))));
+        }
+        cv::Mat transform = cv::getPerspectiveTransform(src, dst);
+        cv::warpPerspective(boardImage, frame, transform, frame.size(), cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+
+        cv::Mat noise(frame.size(), CV_16SC1);
+        rng.fill(noise, cv::RNG::NORMAL, 0, 4);
+        cv::Mat noisy;
+        frame.convertTo(noisy, CV_16SC1);
+        noisy += noise;
+        noisy.convertTo(frame, CV_8UC1);
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+// Recorded frames from a directory of images or a video file
+std::vector<cv::Mat> loadFrames(const std::string& path) {
+    std::vector<cv::Mat> frames;
+    if (std::filesystem::is_directory(path)) {
+        std::vector<std::filesystem::path> files;
+        for (const auto& entry : std::filesystem::directory_iterator(path)) {
+            files.push_back(entry.path());
+        }
+        std::sort(files.begin(), files.end());
+        for (const auto& file : files) {
+            cv::Mat image = cv::imread(file.string(), cv::IMREAD_GRAYSCALE);
+            if (!image.empty()) frames.push_back(image);
+        }
+    }
+    else {
+        cv::VideoCapture cap(path);
+        cv::Mat frame, gray;
+        while (cap.read(frame)) {
+            cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+            frames.push_back(gray.clone());
+        }
+    }
+    return frames;
+}
+
+int main(int argc, char* argv[]) {
+    const int iterations = 20;
+
+    // Same board as App
+    cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
+    cv::aruco::CharucoBoard board(cv::Size(5, 7), 0.038f, 0.019f, dictionary);
+    cv::aruco::DetectorParameters detectorParams;
+
+    std::vector<cv::Mat> frames = argc > 1 ? loadFrames(argv[1]) : makeSyntheticFrames(board, 8);
+    if (frames.empty()) {
+        std::cerr << "No frames to benchmark" << std::endl;
+        return 1;
+    }
+    std::cout << "Frames: " << frames.size() << " (" << frames[0].cols << "x" << frames[0].rows << ")" << std::endl;
+    std::cout << "Threshold kernel: " << thresholdKernelName() << std::endl;
+
+    bool failed = false;
+
+    // Threshold has to match OpenCV exactly
+    std::cout << "\n=== Threshold validation ===" << std::endl;
+    std::vector<uint32_t> integral;
+    for (int winSize = detectorParams.adaptiveThreshWinSizeMin; winSize <= detectorParams.adaptiveThreshWinSizeMax;
+        winSize += detectorParams.adaptiveThreshWinSizeStep) {
+        int mismatches = 0;
+        for (const auto& frame : frames) {
+            cv::Mat reference, simd, scalar;
+            cv::adaptiveThreshold(frame, reference, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY_INV,
+                winSize, detectorParams.adaptiveThreshConstant);
+            integralAdaptiveThreshold(frame, simd, winSize, detectorParams.adaptiveThreshConstant, integral, true);
+            integralAdaptiveThreshold(frame, scalar, winSize, detectorParams.adaptiveThreshConstant, integral, false);
+            mismatches += cv::countNonZero(reference != simd) + cv::countNonZero(reference != scalar);
+        }
+        std::cout << "Window " << winSize << ": " << mismatches << " mismatching pixels" << std::endl;
+        failed |= mismatches != 0;
+    }
+
+    // Markers found by the fast front end compared to the stock detector
+    std::cout << "\n=== Detection comparison ===" << std::endl;
+    cv::aruco::ArucoDetector arucoDetector(dictionary, detectorParams);
+    FastMarkerDetector fastDetector(dictionary, detectorParams);
+    int referenceMarkers = 0, matchedMarkers = 0, extraMarkers = 0, missedMarkers = 0;
+    double maxCornerError = 0;
+    for (const auto& frame : frames) {
+        std::vector<std::vector<cv::Point2f>> referenceCorners, fastCorners;
+        std::vector<int> referenceIds, fastIds;
+        arucoDetector.detectMarkers(frame, referenceCorners, referenceIds);
+        fastDetector.detectMarkers(frame, fastCorners, fastIds);
+
+        referenceMarkers += int(referenceIds.size());
+        for (int id : referenceIds) {
+            if (std::find(fastIds.begin(), fastIds.end(), id) == fastIds.end()) missedMarkers++;
+        }
+        for (size_t i = 0; i < fastIds.size(); i++) {
+            auto it = std::find(referenceIds.begin(), referenceIds.end(), fastIds[i]);
+            if (it == referenceIds.end()) {
+                extraMarkers++;
+                continue;
+            }
+            matchedMarkers++;
+            const auto& reference = referenceCorners[it - referenceIds.begin()];
+            for (int c = 0; c < 4; c++) {
+                maxCornerError = std::max(maxCornerError, double(cv::norm(reference[c] - fastCorners[i][c])));
+            }
+        }
+    }
+    std::cout << "Stock markers: " << referenceMarkers << ", matched: " << matchedMarkers
+        << ", missed: " << missedMarkers << ", not in stock: " << extraMarkers
+        << ", max corner error: " << maxCornerError << " px" << std::endl;
+    // The fast front end thresholds with one window where the stock detector tries several,
+    // so it may lose the odd marker but no more than this share of them
+    const double maxMissedFraction = 0.01;
+    if (missedMarkers > maxMissedFraction * referenceMarkers) {
+        std::cout << "Fast front end missed more than " << maxMissedFraction * 100 << "% of the stock markers" << std::endl;
+        failed = true;
+    }
+
+    // Per kernel timings, averaged over all frames
+    std::cout << "\n=== Timings (ms per frame) ===" << std::endl;
+    auto perFrame = [&](const std::function<void(const cv::Mat&)>& f) {
+        double total = 0;
+        for (const auto& frame : frames) {
+            total += timeMs([&] { f(frame); }, iterations);
+        }
+        return total / frames.size();
+    };
+
+    cv::Mat binary;
+    const int winSize = fastDetector.thresholdWinSize;
+    std::cout << "cv::adaptiveThreshold, all windows: " << perFrame([&](const cv::Mat& frame) {
+        for (int w = detectorParams.adaptiveThreshWinSizeMin; w <= detectorParams.adaptiveThreshWinSizeMax;
+            w += detectorParams.adaptiveThreshWinSizeStep) {
+            cv::adaptiveThreshold(frame, binary, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY_INV, w,
+                detectorParams.adaptiveThreshConstant);
+        }
+    }) << std::endl;
+    std::cout << "cv::adaptiveThreshold, window " << winSize << ": " << perFrame([&](const cv::Mat& frame) {
+        cv::adaptiveThreshold(frame, binary, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY_INV, winSize,
+            detectorParams.adaptiveThreshConstant);
+    }) << std::endl;
+    std::cout << "Integral threshold (scalar): " << perFrame([&](const cv::Mat& frame) {
+        integralAdaptiveThreshold(frame, binary, winSize, detectorParams.adaptiveThreshConstant, integral, false);
+    }) << std::endl;
+    std::cout << "Integral threshold (" << thresholdKernelName() << "): " << perFrame([&](const cv::Mat& frame) {
+        integralAdaptiveThreshold(frame, binary, winSize, detectorParams.adaptiveThreshConstant, integral, true);
+    }) << std::endl;
+
+    // Later stages run on the output of the previous one, computed once up front
+    std::vector<cv::Mat> binaries(frames.size());
+    std::vector<std::vector<std::vector<cv::Point2f>>> frameCandidates(frames.size());
+    for (size_t i = 0; i < frames.size(); i++) {
+        fastDetector.threshold(frames[i], binaries[i]);
+        fastDetector.findCandidates(binaries[i], frameCandidates[i]);
+    }
+    auto perStage = [&](const std::function<void(size_t)>& f) {
+        double total = 0;
+        for (size_t i = 0; i < frames.size(); i++) {
+            total += timeMs([&] { f(i); }, iterations);
+        }
+        return total / frames.size();
+    };
+
+    std::vector<std::vector<cv::Point2f>> candidates, corners;
+    std::vector<int> ids;
+    std::cout << "Quad candidates: " << perStage([&](size_t i) {
+        fastDetector.findCandidates(binaries[i], candidates);
+    }) << std::endl;
+    std::cout << "Decode: " << perStage([&](size_t i) {
+        fastDetector.decodeCandidates(frames[i], frameCandidates[i], corners, ids);
+    }) << std::endl;
+
+    std::cout << "ArucoDetector::detectMarkers: " << perFrame([&](const cv::Mat& frame) {
+        arucoDetector.detectMarkers(frame, corners, ids);
+    }) << std::endl;
+    std::cout << "FastMarkerDetector::detectMarkers: " << perFrame([&](const cv::Mat& frame) {
+        fastDetector.detectMarkers(frame, corners, ids);
+    }) << std::endl;
+
+    // Code table against Dictionary::identify, on noisy marker codes and on the random codes clutter produces
+    std::cout << "\n=== Marker code lookup ===" << std::endl;
+    int64 buildStart = cv::getTickCount();
+    MarkerCodeTable codeTable(dictionary, detectorParams.errorCorrectionRate);
+    double buildMs = double(cv::getTickCount() - buildStart) * 1000.0 / cv::getTickFrequency();
+    std::cout << "Codes: " << codeTable.codeCount() << ", correction radius: " << codeTable.correctionRadius()
+        << ", build: " << buildMs << " ms" << std::endl;
+
+    const std::string tablePath = (std::filesystem::temp_directory_path() / "marker_codes.bin").string();
+    MarkerCodeTable loadedTable;
+    bool loaded = false;
+    if (codeTable.save(tablePath)) {
+        int64 loadStart = cv::getTickCount();
+        loaded = loadedTable.load(tablePath, dictionary, detectorParams.errorCorrectionRate);
+        double loadMs = double(cv::getTickCount() - loadStart) * 1000.0 / cv::getTickFrequency();
+        std::cout << "Saved to " << tablePath << ", load: " << loadMs << " ms" << std::endl;
+        std::filesystem::remove(tablePath);
+    }
+    // Without a loaded table there is nothing to compare it with below
+    if (!loaded) {
+        std::cout << "Save and load of the table failed, skipping the loaded table check" << std::endl;
+        failed = true;
+    }
+
+    const int markerSize = dictionary.markerSize;
+    const int codeBits = markerSize * markerSize;
+    cv::RNG codeRng(99);
+    std::vector<cv::Mat> markerCodes, clutterCodes;
+    for (int i = 0; i < 4000; i++) {
+        // A marker in a random rotation with up to two more errors than can be corrected
+        cv::Mat bits = cv::aruco::Dictionary::getBitsFromByteList(
+            dictionary.bytesList.rowRange(i % dictionary.bytesList.rows, i % dictionary.bytesList.rows + 1), markerSize);
+        for (int r = codeRng.uniform(0, 4); r > 0; r--) {
+            cv::rotate(bits, bits, cv::ROTATE_90_CLOCKWISE);
+        }
+        for (int e = codeRng.uniform(0, codeTable.correctionRadius() + 3); e > 0; e--) {
+            int bit = codeRng.uniform(0, codeBits);
+            bits.at<uchar>(bit / markerSize, bit % markerSize) ^= 1;
+        }
+        markerCodes.push_back(bits);
+
+        cv::Mat clutter(markerSize, markerSize, CV_8UC1);
+        codeRng.fill(clutter, cv::RNG::UNIFORM, 0, 2);
+        clutterCodes.push_back(clutter);
+    }
+
+    int lookupMismatches = 0;
+    for (const auto* codes : { &markerCodes, &clutterCodes }) {
+        for (const auto& bits : *codes) {
+            int stockId = -1, stockRotation = -1, tableId = -1, tableRotation = -1, loadedId = -1, loadedRotation = -1;
+            bool stockFound = dictionary.identify(bits, stockId, stockRotation, detectorParams.errorCorrectionRate);
+            uint64_t packed = MarkerCodeTable::packBits(bits);
+            bool tableFound = codeTable.identify(packed, tableId, tableRotation);
+            bool loadedFound = loaded ? loadedTable.identify(packed, loadedId, loadedRotation) : tableFound;
+            if (!loaded) {
+                loadedId = tableId;
+                loadedRotation = tableRotation;
+            }
+            if (stockFound != tableFound || (stockFound && (stockId != tableId || stockRotation != tableRotation)) ||
+                loadedFound != tableFound || loadedId != tableId || loadedRotation != tableRotation) {
+                lookupMismatches++;
+            }
+        }
+    }
+    std::cout << "Mismatches against Dictionary::identify: " << lookupMismatches << std::endl;
+    failed |= lookupMismatches != 0;
+
+    auto perLookupNs = [&](const std::vector<cv::Mat>& codes, bool table) {
+        std::vector<uint64_t> packed;
+        for (const auto& bits : codes) packed.push_back(MarkerCodeTable::packBits(bits));
+        double ms = timeMs([&] {
+            int id, rotation;
+            for (size_t i = 0; i < codes.size(); i++) {
+                if (table) codeTable.identify(packed[i], id, rotation);
+                else dictionary.identify(codes[i], id, rotation, detectorParams.errorCorrectionRate);
+            }
+        }, iterations);
+        return ms * 1e6 / codes.size();
+    };
+    std::cout << "Dictionary::identify, markers: " << perLookupNs(markerCodes, false) << " ns, clutter: "
+        << perLookupNs(clutterCodes, false) << " ns" << std::endl;
+    std::cout << "MarkerCodeTable::identify, markers: " << perLookupNs(markerCodes, true) << " ns, clutter: "
+        << perLookupNs(clutterCodes, true) << " ns" << std::endl;
+
+    // Whole decode stage on the cluttered frames, the table has to give the same markers
+    int decodeMismatches = 0;
+    for (size_t i = 0; i < frames.size(); i++) {
+        std::vector<std::vector<cv::Point2f>> stockCorners;
+        std::vector<int> stockIds;
+        fastDetector.useCodeTable = false;
+        fastDetector.decodeCandidates(frames[i], frameCandidates[i], stockCorners, stockIds);
+        fastDetector.useCodeTable = true;
+        fastDetector.decodeCandidates(frames[i], frameCandidates[i], corners, ids);
+        decodeMismatches += ids != stockIds || corners != stockCorners ? 1 : 0;
+    }
+    size_t totalCandidates = 0;
+    for (const auto& candidates : frameCandidates) totalCandidates += candidates.size();
+    std::cout << "Candidates per frame: " << totalCandidates / frames.size()
+        << ", frames decoded differently: " << decodeMismatches << std::endl;
+    failed |= decodeMismatches != 0;
+    fastDetector.useCodeTable = false;
+    std::cout << "Decode with Dictionary::identify: " << perStage([&](size_t i) {
+        fastDetector.decodeCandidates(frames[i], frameCandidates[i], corners, ids);
+    }) << " ms" << std::endl;
+    fastDetector.useCodeTable = true;
+    std::cout << "Decode with MarkerCodeTable: " << perStage([&](size_t i) {
+        fastDetector.decodeCandidates(frames[i], frameCandidates[i], corners, ids);
+    }) << " ms" << std::endl;
+
+    // Tiled detection with growing pool sizes, the calling thread counts as one of the threads.
+    // The default maxMarkerPerimeterRate allows markers as large as the frame and leaves a single tile,
+    // markers up to a quarter of the frame wide still give every tile its own area.
+    std::cout << "\n=== Tiled detection scaling ===" << std::endl;
+    cv::aruco::DetectorParameters tiledParams = detectorParams;
+    tiledParams.maxMarkerPerimeterRate = 1.0;
+    fastDetector.setDetectorParameters(tiledParams);
+    std::cout << "Tile overlap: " << fastDetector.tileOverlap(frames[0].size()) << " px" << std::endl;
+    double untiledMs = perFrame([&](const cv::Mat& frame) { fastDetector.detectMarkers(frame, corners, ids); });
+    double singleThreadMs = 0;
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads <= cores; threads = threads * 2 > cores && threads < cores ? cores : threads * 2) {
+        ThreadPool pool(threads - 1);
+        double tiledMs = perFrame([&](const cv::Mat& frame) { fastDetector.detectMarkersTiled(frame, corners, ids, pool); });
+        if (threads == 1) singleThreadMs = tiledMs;
+        std::cout << threads << " threads: " << tiledMs << " ms, " << singleThreadMs / tiledMs << "x vs 1 thread, "
+            << untiledMs / tiledMs << "x vs untiled" << std::endl;
+    }
+
+    // Tiling must find the same markers
+    ThreadPool pool;
+    int tiledMissing = 0;
+    for (const auto& frame : frames) {
+        std::vector<int> tiledIds;
+        fastDetector.detectMarkers(frame, corners, ids);
+        fastDetector.detectMarkersTiled(frame, corners, tiledIds, pool);
+        for (int id : ids) {
+            if (std::find(tiledIds.begin(), tiledIds.end(), id) == tiledIds.end()) tiledMissing++;
+        }
+    }
+    std::cout << "Markers missed by tiling: " << tiledMissing << std::endl;
+    failed |= tiledMissing != 0;
+
+    if (failed) {
+        std::cerr << "\nFast detection does not match OpenCV or the untiled detection" << std::endl;
+        return 1;
+    }
+    return 0;
+}
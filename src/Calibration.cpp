@@ -3,25 +3,11 @@
 #include <iostream>
 #include <vector>
 #include <filesystem>
+#include "CalibrationStore.hpp"
 
 void testCamera(const std::string& path) {
-    if (!std::filesystem::exists(path)) {
-        std::cerr << "Camera calibration file not found: " << path << std::endl;
-        return;
-    }
-
-    cv::FileStorage fs(path, cv::FileStorage::READ);
-    if (!fs.isOpened()) {
-        std::cerr << "Failed to open calibration file: " << path << std::endl;
-        return;
-    }
-
-    cv::Mat cameraMatrix, distortionCoefficients;
-    fs["camera_matrix"] >> cameraMatrix;
-    fs["distortion_coefficients"] >> distortionCoefficients;
-    fs.release();
-
-    if (cameraMatrix.empty() || distortionCoefficients.empty()) {
+    CameraCalibration calibration;
+    if (!loadCalibration(path, calibration)) {
         std::cerr << "Failed to read calibration data from file" << std::endl;
         return;
     }
@@ -41,7 +27,10 @@ void testCamera(const std::string& path) {
         if (frameBefore.empty()) break;
 
         cv::imshow("Before", frameBefore);
-        cv::undistort(frameBefore, frameAfter, cameraMatrix, distortionCoefficients);
+        if (calibration.undistortMap.size() != frameBefore.size() && !buildUndistortMap(calibration, frameBefore.size())) {
+            break;
+        }
+        cv::remap(frameBefore, frameAfter, calibration.undistortMap, cv::noArray(), cv::INTER_LINEAR);
         cv::imshow("After", frameAfter);
 
         if (cv::waitKey(30) == 27) break;  // ESC to exit
@@ -127,17 +116,19 @@ void calibrateCamera(std::string calibrationFile) {
     std::cout << "Camera matrix:\n" << cameraMatrix << std::endl;
     std::cout << "Distortion coefficients:\n" << distortionCoefficients << std::endl;
 
-    // Save calibration to absolute path
-    cv::FileStorage fs(calibrationFile, cv::FileStorage::WRITE);
-    if (!fs.isOpened()) {
-        std::cerr << "Failed to create calibration file: " << calibrationFile << std::endl;
+    // Save calibration to absolute path, with a binary copy that App loads without rebuilding the maps
+    CameraCalibration calibration;
+    calibration.cameraMatrix = cameraMatrix;
+    calibration.distortionCoefficients = distortionCoefficients.reshape(1, 1);
+    calibration.imageSize = imageSize;
+    calibration.reprojectionError = reprojectionError;
+    if (!saveCalibrationYaml(calibrationFile, calibration)) {
+        return;
+    }
+    buildUndistortMap(calibration, imageSize);
+    if (!saveCalibrationBinary(calibrationBinaryPath(calibrationFile), calibration)) {
         return;
     }
-    fs << "camera_matrix" << cameraMatrix;
-    fs << "distortion_coefficients" << distortionCoefficients;
-    //fs << "rvecs" << rvecs;
-    //fs << "tvecs" << tvecs;
-    fs.release();
 
     std::cout << "Calibration saved to: " << calibrationFile << std::endl;
     return;
@@ -156,6 +147,7 @@ int main() {
         std::cin >> redoCalibration;
         if (redoCalibration != "n") {
             std::filesystem::remove(calibrationFile);
+            std::filesystem::remove(calibrationBinaryPath(calibrationFile));
             std::cout << "Deleted cameraMatrix.yaml" << std::endl;
             calibrateCamera(calibrationFile);
         }
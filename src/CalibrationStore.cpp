@@ -0,0 +1,264 @@
+#include "CalibrationStore.hpp"
+#include "LittleEndian.hpp"
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core/persistence.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace {
+    const char binaryMagic[4] = { 'V', 'C', 'C', 'B' };
+    const uint32_t binaryVersion = 1;
+
+    // FNV-1a, enough to catch truncated or corrupted files
+    uint64_t checksum(const char* data, size_t size) {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= uint8_t(data[i]);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    bool fail(const std::string& path, const std::string& reason) {
+        std::cerr << "Invalid calibration " << path << ": " << reason << std::endl;
+        return false;
+    }
+
+    bool validate(const std::string& path, const CameraCalibration& calibration) {
+        const cv::Mat& K = calibration.cameraMatrix;
+        if (K.rows != 3 || K.cols != 3 || K.type() != CV_64F) return fail(path, "camera matrix is not 3x3 doubles");
+        if (!cv::checkRange(K)) return fail(path, "camera matrix is not finite");
+        if (K.at<double>(0, 0) <= 0 || K.at<double>(1, 1) <= 0) return fail(path, "focal length is not positive");
+        if (K.at<double>(2, 2) != 1.0) return fail(path, "camera matrix is not normalised");
+
+        const cv::Mat& D = calibration.distortionCoefficients;
+        const size_t count = D.total();
+        if (D.type() != CV_64F || D.rows != 1 || (count != 4 && count != 5 && count != 8 && count != 12 && count != 14)) {
+            return fail(path, "distortion coefficients are not 4, 5, 8, 12 or 14 doubles");
+        }
+        if (!cv::checkRange(D)) return fail(path, "distortion coefficients are not finite");
+
+        if (calibration.imageSize.width < 0 || calibration.imageSize.height < 0) return fail(path, "negative image size");
+
+        const cv::Mat& map = calibration.undistortMap;
+        if (!map.empty() && map.type() != CV_32FC2) return fail(path, "undistortion map is not 2 floats per pixel");
+        return true;
+    }
+}
+
+std::string calibrationBinaryPath(const std::string& yamlPath) {
+    return std::filesystem::path(yamlPath).replace_extension(".bin").string();
+}
+
+bool cameraMatrixForSize(const CameraCalibration& calibration, cv::Size frameSize, cv::Mat& cameraMatrix) {
+    const cv::Size& imageSize = calibration.imageSize;
+    if (imageSize.area() == 0 || imageSize == frameSize) {
+        cameraMatrix = calibration.cameraMatrix.clone();
+        return true;
+    }
+    // Same aspect ratio up to a pixel of rounding
+    if (std::abs(double(frameSize.width) * imageSize.height - double(frameSize.height) * imageSize.width) >
+        double(std::max(imageSize.width, imageSize.height))) {
+        std::cerr << "Calibration made at " << imageSize << " does not fit frames of " << frameSize << std::endl;
+        return false;
+    }
+
+    // Pixel centres scale, not pixel corners
+    const double sx = double(frameSize.width) / imageSize.width;
+    const double sy = double(frameSize.height) / imageSize.height;
+    cameraMatrix = calibration.cameraMatrix.clone();
+    cameraMatrix.at<double>(0, 0) *= sx;
+    cameraMatrix.at<double>(0, 1) *= sx;
+    cameraMatrix.at<double>(1, 1) *= sy;
+    cameraMatrix.at<double>(0, 2) = (cameraMatrix.at<double>(0, 2) + 0.5) * sx - 0.5;
+    cameraMatrix.at<double>(1, 2) = (cameraMatrix.at<double>(1, 2) + 0.5) * sy - 0.5;
+    return true;
+}
+
+bool buildUndistortMap(CameraCalibration& calibration, cv::Size frameSize) {
+    cv::Mat cameraMatrix;
+    if (!cameraMatrixForSize(calibration, frameSize, cameraMatrix)) return false;
+    cv::initUndistortRectifyMap(cameraMatrix, calibration.distortionCoefficients, cv::Mat(),
+        cameraMatrix, frameSize, CV_32FC2, calibration.undistortMap, cv::noArray());
+    return true;
+}
+
+bool saveCalibrationYaml(const std::string& path, const CameraCalibration& calibration) {
+    cv::FileStorage fs(path, cv::FileStorage::WRITE);
+    if (!fs.isOpened()) {
+        std::cerr << "Failed to create calibration file: " << path << std::endl;
+        return false;
+    }
+    fs << "image_width" << calibration.imageSize.width;
+    fs << "image_height" << calibration.imageSize.height;
+    fs << "camera_matrix" << calibration.cameraMatrix;
+    fs << "distortion_coefficients" << calibration.distortionCoefficients;
+    fs << "avg_reprojection_error" << calibration.reprojectionError;
+    fs.release();
+    return true;
+}
+
+bool saveCalibrationBinary(const std::string& path, const CameraCalibration& calibration) {
+    if (!validate(path, calibration)) return false;
+
+    std::vector<char> buffer(binaryMagic, binaryMagic + sizeof(binaryMagic));
+    appendLittleEndian(buffer, binaryVersion);
+    appendLittleEndian(buffer, int32_t(calibration.imageSize.width));
+    appendLittleEndian(buffer, int32_t(calibration.imageSize.height));
+    appendLittleEndian(buffer, calibration.reprojectionError);
+    for (int i = 0; i < 9; i++) {
+        appendLittleEndian(buffer, calibration.cameraMatrix.at<double>(i / 3, i % 3));
+    }
+    appendLittleEndian(buffer, uint32_t(calibration.distortionCoefficients.total()));
+    for (size_t i = 0; i < calibration.distortionCoefficients.total(); i++) {
+        appendLittleEndian(buffer, calibration.distortionCoefficients.at<double>(int(i)));
+    }
+
+    const cv::Mat& map = calibration.undistortMap;
+    appendLittleEndian(buffer, int32_t(map.cols));
+    appendLittleEndian(buffer, int32_t(map.rows));
+    const bool littleEndian = hostIsLittleEndian();
+    for (int y = 0; y < map.rows; y++) {
+        const float* row = map.ptr<float>(y);
+        if (littleEndian) {
+            const char* bytes = reinterpret_cast<const char*>(row);
+            buffer.insert(buffer.end(), bytes, bytes + map.cols * map.elemSize());
+        }
+        else {
+            for (int x = 0; x < map.cols * 2; x++) appendLittleEndian(buffer, row[x]);
+        }
+    }
+    appendLittleEndian(buffer, checksum(buffer.data(), buffer.size()));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.write(buffer.data(), std::streamsize(buffer.size()))) {
+        std::cerr << "Failed to write calibration file: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool loadCalibrationYaml(const std::string& path, CameraCalibration& calibration) {
+    if (!std::filesystem::exists(path)) {
+        std::cerr << "Camera calibration file not found: " << path << std::endl;
+        return false;
+    }
+
+    try {
+        cv::FileStorage fs(path, cv::FileStorage::READ);
+        if (!fs.isOpened()) {
+            std::cerr << "Failed to open calibration file: " << path << std::endl;
+            return false;
+        }
+
+        cv::Mat cameraMatrix, distortionCoefficients;
+        fs["camera_matrix"] >> cameraMatrix;
+        fs["distortion_coefficients"] >> distortionCoefficients;
+        if (cameraMatrix.empty() || distortionCoefficients.empty()) {
+            return fail(path, "camera_matrix or distortion_coefficients missing");
+        }
+
+        calibration = CameraCalibration();
+        cameraMatrix.convertTo(calibration.cameraMatrix, CV_64F);
+        distortionCoefficients.reshape(1, 1).convertTo(calibration.distortionCoefficients, CV_64F);
+
+        // Older files only have the matrices
+        if (!fs["image_width"].empty() && !fs["image_height"].empty()) {
+            calibration.imageSize = cv::Size((int)fs["image_width"], (int)fs["image_height"]);
+        }
+        if (!fs["avg_reprojection_error"].empty()) {
+            calibration.reprojectionError = (double)fs["avg_reprojection_error"];
+        }
+    }
+    catch (const cv::Exception& e) {
+        return fail(path, e.what());
+    }
+
+    return validate(path, calibration);
+}
+
+bool loadCalibrationBinary(const std::string& path, CameraCalibration& calibration) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "Camera calibration file not found: " << path << std::endl;
+        return false;
+    }
+
+    std::vector<char> buffer(size_t(file.tellg()));
+    file.seekg(0);
+    if (!file.read(buffer.data(), std::streamsize(buffer.size()))) return fail(path, "read error");
+
+    uint64_t storedChecksum;
+    if (buffer.size() < sizeof(binaryMagic) + sizeof(storedChecksum)) return fail(path, "file too short");
+    LittleEndianReader checksumReader{ buffer, buffer.size(), buffer.size() - sizeof(storedChecksum) };
+    checksumReader.read(storedChecksum);
+    if (storedChecksum != checksum(buffer.data(), buffer.size() - sizeof(storedChecksum))) return fail(path, "checksum mismatch");
+
+    LittleEndianReader reader{ buffer, buffer.size() - sizeof(storedChecksum) };
+    char magic[sizeof(binaryMagic)];
+    uint32_t version;
+    if (!reader.read(magic, sizeof(magic)) || std::memcmp(magic, binaryMagic, sizeof(magic)) != 0) return fail(path, "not a calibration file");
+    if (!reader.read(version) || version != binaryVersion) return fail(path, "unsupported version");
+
+    CameraCalibration loaded;
+    int32_t width, height;
+    uint32_t distortionCount;
+    loaded.cameraMatrix.create(3, 3, CV_64F);
+    bool ok = reader.read(width) && reader.read(height) && reader.read(loaded.reprojectionError);
+    for (int i = 0; i < 9 && ok; i++) {
+        ok = reader.read(loaded.cameraMatrix.at<double>(i / 3, i % 3));
+    }
+    ok = ok && reader.read(distortionCount);
+    if (!ok) return fail(path, "truncated header");
+    if (distortionCount < 4 || distortionCount > 14) return fail(path, "distortion coefficients are not 4 to 14 doubles");
+    loaded.imageSize = cv::Size(width, height);
+
+    loaded.distortionCoefficients.create(1, int(distortionCount), CV_64F);
+    for (int i = 0; i < int(distortionCount) && ok; i++) {
+        ok = reader.read(loaded.distortionCoefficients.at<double>(i));
+    }
+    int32_t mapWidth, mapHeight;
+    ok = ok && reader.read(mapWidth) && reader.read(mapHeight) && mapWidth >= 0 && mapHeight >= 0;
+    if (!ok) return fail(path, "truncated distortion coefficients");
+
+    if (mapWidth > 0 && mapHeight > 0) {
+        loaded.undistortMap.create(mapHeight, mapWidth, CV_32FC2);
+        const size_t mapBytes = loaded.undistortMap.total() * loaded.undistortMap.elemSize();
+        if (reader.end - reader.position < mapBytes) return fail(path, "truncated undistortion map");
+        if (hostIsLittleEndian()) {
+            reader.read(loaded.undistortMap.data, mapBytes);
+        }
+        else {
+            float* values = loaded.undistortMap.ptr<float>();
+            for (size_t i = 0; i < loaded.undistortMap.total() * 2; i++) reader.read(values[i]);
+        }
+    }
+    if (reader.position != reader.end) return fail(path, "trailing data");
+
+    if (!validate(path, loaded)) return false;
+    calibration = loaded;
+    return true;
+}
+
+bool loadCalibration(const std::string& path, CameraCalibration& calibration) {
+    if (std::filesystem::path(path).extension() == ".bin") {
+        return loadCalibrationBinary(path, calibration);
+    }
+
+    // The binary is only trusted when it is at least as new as the YAML it was written with
+    const std::string binaryPath = calibrationBinaryPath(path);
+    std::error_code error;
+    if (std::filesystem::exists(binaryPath, error) && (!std::filesystem::exists(path, error) ||
+        std::filesystem::last_write_time(binaryPath, error) >= std::filesystem::last_write_time(path, error))) {
+        if (loadCalibrationBinary(binaryPath, calibration)) return true;
+        std::cerr << "Falling back to " << path << std::endl;
+    }
+    return loadCalibrationYaml(path, calibration);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <string>
+
+// Everything needed to undistort frames of one camera
+struct CameraCalibration {
+    cv::Mat cameraMatrix;           // 3x3 CV_64F
+    cv::Mat distortionCoefficients; // 1xN CV_64F
+    cv::Size imageSize;             // Size the calibration was made at, 0x0 if unknown
+    double reprojectionError = -1;  // RMS reprojection error in pixels, -1 if unknown
+    cv::Mat undistortMap;           // CV_32FC2 destination -> source lookup, sized for the frames it was built for, may be empty
+};
+
+// Binary calibration file stored next to a YAML file: same name with a .bin extension
+std::string calibrationBinaryPath(const std::string& yamlPath);
+
+// Camera matrix of the calibration for frames scaled to another size. Fails for another aspect ratio,
+// the frames are then cropped and the matrix cannot be recovered.
+bool cameraMatrixForSize(const CameraCalibration& calibration, cv::Size frameSize, cv::Mat& cameraMatrix);
+
+// Builds the undistortion map of the calibration for frames of the given size, fails like cameraMatrixForSize.
+// imageSize is left as it is.
+bool buildUndistortMap(CameraCalibration& calibration, cv::Size frameSize);
+
+bool saveCalibrationYaml(const std::string& path, const CameraCalibration& calibration);
+
+// Versioned little-endian binary with a checksum, written and read byte by byte on big-endian hosts, including the undistortion map so it does not
+// have to be rebuilt at startup
+bool saveCalibrationBinary(const std::string& path, const CameraCalibration& calibration);
+
+bool loadCalibrationYaml(const std::string& path, CameraCalibration& calibration);
+bool loadCalibrationBinary(const std::string& path, CameraCalibration& calibration);
+
+// Loads a calibration from a .bin or YAML file. For a YAML file a valid binary next to it is preferred.
+// Every field is validated, a missing or broken calibration returns false with the reason on stderr.
+bool loadCalibration(const std::string& path, CameraCalibration& calibration);
@@ -0,0 +1,426 @@
+#include "FastMarkerDetector.hpp"
+
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#if defined(FAST_MARKER_AVX2)
+// FastMarkerDetectorAvx2.cpp, the only file built with AVX2
+int thresholdRowAvx2(const unsigned char* src, unsigned char* dst, int width, const uint32_t* top, const uint32_t* bottom,
+    int winSize, int idelta);
+#endif
+
+namespace {
+    // Integral image of the gray image padded by r pixels of BORDER_REPLICATE on every side.
+    // Row py holds the sums of all padded pixels above py, so a window sum is four lookups.
+    // Sums are kept modulo 2^32, window differences stay exact as long as a window fits in 32 bits.
+    void buildPaddedIntegral(const cv::Mat& gray, int r, std::vector<uint32_t>& integral) {
+        const int width = gray.cols + 2 * r;
+        const int height = gray.rows + 2 * r;
+        const size_t stride = size_t(width) + 1;
+        integral.assign(stride * (size_t(height) + 1), 0);
+
+        for (int py = 0; py < height; py++) {
+            const uchar* src = gray.ptr<uchar>(std::clamp(py - r, 0, gray.rows - 1));
+            const uint32_t* above = &integral[size_t(py) * stride];
+            uint32_t* row = &integral[size_t(py + 1) * stride];
+
+            uint32_t rowSum = 0;
+            int px = 0;
+            for (; px < r; px++) {
+                rowSum += src[0];
+                row[px + 1] = above[px + 1] + rowSum;
+            }
+            for (int x = 0; x < gray.cols; x++, px++) {
+                rowSum += src[x];
+                row[px + 1] = above[px + 1] + rowSum;
+            }
+            for (; px < width; px++) {
+                rowSum += src[gray.cols - 1];
+                row[px + 1] = above[px + 1] + rowSum;
+            }
+        }
+    }
+
+    // Output is 255 where src <= round(windowSum / area) - idelta.
+    // Written without a division as (src + idelta) * 2 * area <= 2 * windowSum + area.
+    // The area is odd so the mean is never exactly halfway and rounding has no ties.
+    inline uchar thresholdPixel(int src, uint32_t windowSum, int idelta, int area) {
+        return (src + idelta) * 2 * area <= 2 * int(windowSum) + area ? 255 : 0;
+    }
+
+    void thresholdRow(const uchar* src, uchar* dst, int width, const uint32_t* top, const uint32_t* bottom,
+        int winSize, int idelta, bool useSimd) {
+        const int area = winSize * winSize;
+        int x = 0;
+
+#if defined(FAST_MARKER_AVX2)
+        // Checked once, the rest of the file is built for the baseline ISA
+        static const bool hasAvx2 = cv::checkHardwareSupport(CV_CPU_AVX2);
+        if (useSimd && hasAvx2) {
+            x = thresholdRowAvx2(src, dst, width, top, bottom, winSize, idelta);
+        }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        if (useSimd) {
+            const int32x4_t vDelta = vdupq_n_s32(idelta);
+            const int32x4_t vArea = vdupq_n_s32(area);
+            auto compare = [&](uint16x4_t pixels, int offset) {
+                uint32x4_t sum = vsubq_u32(
+                    vaddq_u32(vld1q_u32(bottom + offset + winSize), vld1q_u32(top + offset)),
+                    vaddq_u32(vld1q_u32(bottom + offset), vld1q_u32(top + offset + winSize)));
+                int32x4_t lhs = vmulq_n_s32(vaddq_s32(vreinterpretq_s32_u32(vmovl_u16(pixels)), vDelta), 2 * area);
+                int32x4_t rhs = vaddq_s32(vshlq_n_s32(vreinterpretq_s32_u32(sum), 1), vArea);
+                return vmovn_u32(vcleq_s32(lhs, rhs));
+            };
+            for (; x + 8 <= width; x += 8) {
+                uint16x8_t pixels = vmovl_u8(vld1_u8(src + x));
+                uint16x8_t mask = vcombine_u16(compare(vget_low_u16(pixels), x), compare(vget_high_u16(pixels), x + 4));
+                vst1_u8(dst + x, vmovn_u16(mask));
+            }
+        }
+#endif
+
+        for (; x < width; x++) {
+            uint32_t sum = bottom[x + winSize] - bottom[x] - top[x + winSize] + top[x];
+            dst[x] = thresholdPixel(src[x], sum, idelta, area);
+        }
+    }
+
+    double elapsedMs(int64 start) {
+        return double(cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+    }
+}
+
+const char* thresholdKernelName() {
+#if defined(FAST_MARKER_AVX2)
+    if (cv::checkHardwareSupport(CV_CPU_AVX2)) return "AVX2";
+    return "scalar";
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
+
+void integralAdaptiveThreshold(const cv::Mat& gray, cv::Mat& binary, int winSize, double constant,
+    std::vector<uint32_t>& integral, bool useSimd) {
+    CV_Assert(gray.type() == CV_8UC1 && !gray.empty());
+    CV_Assert(winSize % 2 == 1 && winSize > 1);
+
+    const int r = winSize / 2;
+    buildPaddedIntegral(gray, r, integral);
+    binary.create(gray.size(), CV_8UC1);
+
+    // Same rounding of the constant as cv::adaptiveThreshold uses for THRESH_BINARY_INV
+    const int idelta = cvFloor(constant);
+    const size_t stride = size_t(gray.cols) + 2 * r + 1;
+    for (int y = 0; y < gray.rows; y++) {
+        const uint32_t* top = &integral[size_t(y) * stride];
+        const uint32_t* bottom = &integral[size_t(y + winSize) * stride];
+        thresholdRow(gray.ptr<uchar>(y), binary.ptr<uchar>(y), gray.cols, top, bottom, winSize, idelta, useSimd);
+    }
+}
+
+FastMarkerDetector::FastMarkerDetector(const cv::aruco::Dictionary& dictionary,
+    const cv::aruco::DetectorParameters& params, int thresholdWinSize)
+    : thresholdWinSize(thresholdWinSize), dictionary(dictionary), params(params),
+      codeTable(dictionary, params.errorCorrectionRate) {
+}
+
+void FastMarkerDetector::setDetectorParameters(const cv::aruco::DetectorParameters& detectorParams) {
+    bool correctionChanged = detectorParams.errorCorrectionRate != params.errorCorrectionRate;
+    params = detectorParams;
+    if (correctionChanged) {
+        codeTable = MarkerCodeTable(dictionary, params.errorCorrectionRate);
+    }
+}
+
+bool FastMarkerDetector::loadCodeTable(const std::string& path) {
+    return codeTable.load(path, dictionary, params.errorCorrectionRate);
+}
+
+void FastMarkerDetector::detectMarkers(const cv::Mat& gray, std::vector<std::vector<cv::Point2f>>& corners, std::vector<int>& ids) {
+    CV_Assert(gray.type() == CV_8UC1);
+    corners.clear();
+    ids.clear();
+
+    int64 start = cv::getTickCount();
+    threshold(gray, binary);
+    timings.threshold = elapsedMs(start);
+
+    start = cv::getTickCount();
+    std::vector<std::vector<cv::Point2f>> candidates;
+    findCandidates(binary, candidates);
+    timings.candidates = elapsedMs(start);
+
+    start = cv::getTickCount();
+    decodeCandidates(gray, candidates, corners, ids);
+    timings.decode = elapsedMs(start);
+}
+
+void FastMarkerDetector::threshold(const cv::Mat& gray, cv::Mat& binary) {
+    integralAdaptiveThreshold(gray, binary, thresholdWinSize, params.adaptiveThreshConstant, integral);
+}
+
+void FastMarkerDetector::findCandidates(const cv::Mat& binary, std::vector<std::vector<cv::Point2f>>& candidates) const {
+    candidates.clear();
+    std::vector<double> perimeters;
+    extractQuads(binary, std::max(binary.cols, binary.rows), cv::Point2f(0, 0), candidates, perimeters);
+    removeNearCandidates(candidates, perimeters);
+}
+
+int FastMarkerDetector::tileOverlap(const cv::Size& imageSize) const {
+    // A closed contour of n pixels spans at most n / 2 pixels in x and in y
+    const int maxDimension = std::max(imageSize.width, imageSize.height);
+    const int maxMarkerSpan = int(params.maxMarkerPerimeterRate * maxDimension) / 2 + 1;
+    // Quads closer than minDistanceToBorder to a tile edge are dropped, keep that much room on both sides
+    const int overlap = maxMarkerSpan + 2 * (std::max(params.minDistanceToBorder, 0) + 1);
+    return std::min(overlap, 2 * maxDimension);
+}
+
+void FastMarkerDetector::detectMarkersTiled(const cv::Mat& gray, std::vector<std::vector<cv::Point2f>>& corners,
+    std::vector<int>& ids, ThreadPool& pool) {
+    CV_Assert(gray.type() == CV_8UC1);
+    corners.clear();
+    ids.clear();
+
+    // Tiles overlap so that every marker the parameters allow lies completely inside at least one tile.
+    // Tiles the overlap stretches over the same area are only searched once.
+    std::vector<cv::Rect> tiles;
+    const int overlap = tileOverlap(gray.size());
+    const int tileWidth = (gray.cols + tileGrid.width - 1) / tileGrid.width;
+    const int tileHeight = (gray.rows + tileGrid.height - 1) / tileGrid.height;
+    const cv::Rect frame(0, 0, gray.cols, gray.rows);
+    for (int ty = 0; ty < tileGrid.height; ty++) {
+        for (int tx = 0; tx < tileGrid.width; tx++) {
+            cv::Rect tile(tx * tileWidth - overlap / 2, ty * tileHeight - overlap / 2,
+                tileWidth + overlap, tileHeight + overlap);
+            tile &= frame;
+            if (!tile.empty() && std::find(tiles.begin(), tiles.end(), tile) == tiles.end()) tiles.push_back(tile);
+        }
+    }
+
+    tileResults.resize(tiles.size());
+
+    int64 start = cv::getTickCount();
+    const int r = thresholdWinSize / 2;
+    const int maxDimension = std::max(gray.cols, gray.rows);
+    pool.parallelFor(int(tiles.size()), [&](int i) {
+        TileResult& result = tileResults[i];
+
+        // Threshold the tile plus half a window around it, so pixels next to the tile edges
+        // see the same neighbourhood as in the full frame
+        cv::Rect padded(tiles[i].x - r, tiles[i].y - r, tiles[i].width + 2 * r, tiles[i].height + 2 * r);
+        padded &= frame;
+        integralAdaptiveThreshold(gray(padded), result.binary, thresholdWinSize, params.adaptiveThreshConstant, result.integral);
+
+        cv::Rect inner(tiles[i].x - padded.x, tiles[i].y - padded.y, tiles[i].width, tiles[i].height);
+        result.quads.clear();
+        result.perimeters.clear();
+        extractQuads(result.binary(inner), maxDimension, cv::Point2f(float(tiles[i].x), float(tiles[i].y)),
+            result.quads, result.perimeters);
+    });
+
+    // Markers in the overlap are found by several tiles, the duplicates are merged here
+    std::vector<std::vector<cv::Point2f>> candidates;
+    std::vector<double> perimeters;
+    for (const auto& result : tileResults) {
+        candidates.insert(candidates.end(), result.quads.begin(), result.quads.end());
+        perimeters.insert(perimeters.end(), result.perimeters.begin(), result.perimeters.end());
+    }
+    removeNearCandidates(candidates, perimeters);
+    timings.threshold = 0; // Included in candidates, the tiles threshold and extract quads in one task
+    timings.candidates = elapsedMs(start);
+
+    // Decode in one chunk per pool thread, keeping the candidate order
+    start = cv::getTickCount();
+    const int chunks = std::max(1, std::min(int(candidates.size()), int(pool.size()) + 1));
+    std::vector<std::vector<std::vector<cv::Point2f>>> chunkCorners(chunks);
+    std::vector<std::vector<int>> chunkIds(chunks);
+    pool.parallelFor(chunks, [&](int c) {
+        size_t begin = candidates.size() * c / chunks;
+        size_t end = candidates.size() * (c + 1) / chunks;
+        std::vector<std::vector<cv::Point2f>> chunk(candidates.begin() + begin, candidates.begin() + end);
+        decodeCandidates(gray, chunk, chunkCorners[c], chunkIds[c]);
+    });
+    for (int c = 0; c < chunks; c++) {
+        corners.insert(corners.end(), chunkCorners[c].begin(), chunkCorners[c].end());
+        ids.insert(ids.end(), chunkIds[c].begin(), chunkIds[c].end());
+    }
+    timings.decode = elapsedMs(start);
+}
+
+void FastMarkerDetector::extractQuads(const cv::Mat& binary, int maxDimension, cv::Point2f offset,
+    std::vector<std::vector<cv::Point2f>>& quads, std::vector<double>& perimeters) const {
+    // Same candidate filters as the stock aruco detector, sized by the full frame
+    const size_t minPerimeterPixels = size_t(params.minMarkerPerimeterRate * maxDimension);
+    const size_t maxPerimeterPixels = size_t(params.maxMarkerPerimeterRate * maxDimension);
+
+    std::vector<std::vector<cv::Point>> contours;
+    cv::findContours(binary, contours, cv::RETR_LIST, cv::CHAIN_APPROX_NONE);
+
+    std::vector<cv::Point> approxCurve;
+    for (const auto& contour : contours) {
+        if (contour.size() < minPerimeterPixels || contour.size() > maxPerimeterPixels) continue;
+
+        cv::approxPolyDP(contour, approxCurve, double(contour.size()) * params.polygonalApproxAccuracyRate, true);
+        if (approxCurve.size() != 4 || !cv::isContourConvex(approxCurve)) continue;
+
+        // Reject quads with a collapsed side
+        double minSideSq = std::numeric_limits<double>::max();
+        for (int j = 0; j < 4; j++) {
+            cv::Point d = approxCurve[j] - approxCurve[(j + 1) % 4];
+            minSideSq = std::min(minSideSq, double(d.x) * d.x + double(d.y) * d.y);
+        }
+        double minCornerDistance = double(contour.size()) * params.minCornerDistanceRate;
+        if (minSideSq < minCornerDistance * minCornerDistance) continue;
+
+        // Reject quads touching the image border, for tiles this also drops markers cut by the tile edge
+        bool tooNearBorder = false;
+        for (const auto& p : approxCurve) {
+            if (p.x < params.minDistanceToBorder || p.y < params.minDistanceToBorder ||
+                p.x > binary.cols - 1 - params.minDistanceToBorder || p.y > binary.rows - 1 - params.minDistanceToBorder) {
+                tooNearBorder = true;
+            }
+        }
+        if (tooNearBorder) continue;
+
+        std::vector<cv::Point2f> quad;
+        for (const auto& p : approxCurve) {
+            quad.push_back(cv::Point2f(float(p.x), float(p.y)) + offset);
+        }
+
+        // Order the corners clockwise
+        double dx1 = quad[1].x - quad[0].x;
+        double dy1 = quad[1].y - quad[0].y;
+        double dx2 = quad[2].x - quad[0].x;
+        double dy2 = quad[2].y - quad[0].y;
+        if (dx1 * dy2 - dy1 * dx2 < 0.0) std::swap(quad[1], quad[3]);
+
+        quads.push_back(quad);
+        perimeters.push_back(double(contour.size()));
+    }
+}
+
+void FastMarkerDetector::removeNearCandidates(std::vector<std::vector<cv::Point2f>>& candidates, std::vector<double>& perimeters) const {
+    // The outer and inner edge of a marker border both become quads, keep the outer one
+    std::vector<bool> removed(candidates.size(), false);
+    for (size_t i = 0; i < candidates.size(); i++) {
+        for (size_t j = i + 1; j < candidates.size() && !removed[i]; j++) {
+            if (removed[j]) continue;
+
+            double minDistSq = std::numeric_limits<double>::max();
+            for (int shift = 0; shift < 4; shift++) {
+                double distSq = 0;
+                for (int c = 0; c < 4; c++) {
+                    cv::Point2f d = candidates[i][c] - candidates[j][(c + shift) % 4];
+                    distSq += d.x * d.x + d.y * d.y;
+                }
+                minDistSq = std::min(minDistSq, distSq / 4.0);
+            }
+
+            double minMarkerDistance = params.minMarkerDistanceRate * std::min(perimeters[i], perimeters[j]);
+            if (minDistSq < minMarkerDistance * minMarkerDistance) {
+                if (perimeters[i] < perimeters[j]) removed[i] = true;
+                else removed[j] = true;
+            }
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (removed[i]) continue;
+        candidates[kept] = candidates[i];
+        perimeters[kept] = perimeters[i];
+        kept++;
+    }
+    candidates.resize(kept);
+    perimeters.resize(kept);
+}
+
+void FastMarkerDetector::decodeCandidates(const cv::Mat& gray, const std::vector<std::vector<cv::Point2f>>& candidates,
+    std::vector<std::vector<cv::Point2f>>& corners, std::vector<int>& ids) const {
+    corners.clear();
+    ids.clear();
+
+    const int markerSize = dictionary.markerSize;
+    const int cells = markerSize + 2 * params.markerBorderBits;
+    const int cellSize = params.perspectiveRemovePixelPerCell;
+    const int resultSize = cells * cellSize;
+    const int cellMargin = int(params.perspectiveRemoveIgnoredMarginPerCell * cellSize);
+    const int maxBorderErrors = int(markerSize * markerSize * params.maxErroneousBitsInBorderRate);
+
+    const std::vector<cv::Point2f> resultCorners = {
+        cv::Point2f(0, 0),
+        cv::Point2f(float(resultSize - 1), 0),
+        cv::Point2f(float(resultSize - 1), float(resultSize - 1)),
+        cv::Point2f(0, float(resultSize - 1))
+    };
+
+    cv::Mat warped, bits;
+    for (const auto& candidate : candidates) {
+        cv::Mat transform = cv::getPerspectiveTransform(candidate, resultCorners);
+        cv::warpPerspective(gray, warped, transform, cv::Size(resultSize, resultSize), cv::INTER_NEAREST);
+
+        // Low contrast means a uniform marker, otherwise split the cells with Otsu
+        bits.create(cells, cells, CV_8UC1);
+        cv::Scalar mean, stddev;
+        cv::meanStdDev(warped(cv::Rect(cellSize / 2, cellSize / 2, resultSize - cellSize, resultSize - cellSize)), mean, stddev);
+        if (stddev[0] < params.minOtsuStdDev) {
+            bits.setTo(mean[0] > 127 ? 1 : 0);
+        }
+        else {
+            cv::threshold(warped, warped, 125, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
+            const int inner = cellSize - 2 * cellMargin;
+            for (int y = 0; y < cells; y++) {
+                for (int x = 0; x < cells; x++) {
+                    cv::Rect cell(x * cellSize + cellMargin, y * cellSize + cellMargin, inner, inner);
+                    bits.at<uchar>(y, x) = cv::countNonZero(warped(cell)) > inner * inner / 2 ? 1 : 0;
+                }
+            }
+        }
+
+        // Border cells have to be black
+        int borderErrors = 0;
+        for (int y = 0; y < cells; y++) {
+            for (int x = 0; x < cells; x++) {
+                bool isBorder = y < params.markerBorderBits || y >= cells - params.markerBorderBits ||
+                    x < params.markerBorderBits || x >= cells - params.markerBorderBits;
+                if (isBorder && bits.at<uchar>(y, x) != 0) borderErrors++;
+            }
+        }
+        if (borderErrors > maxBorderErrors) continue;
+
+        int id, rotation;
+        if (!identify(bits(cv::Rect(params.markerBorderBits, params.markerBorderBits, markerSize, markerSize)), id, rotation)) continue;
+
+        std::vector<cv::Point2f> rotated = candidate;
+        std::rotate(rotated.begin(), rotated.begin() + 4 - rotation, rotated.end());
+        corners.push_back(rotated);
+        ids.push_back(id);
+    }
+
+    // Same sub-pixel refinement the stock detector applies with CORNER_REFINE_SUBPIX
+    if (params.cornerRefinementMethod == cv::aruco::CORNER_REFINE_SUBPIX) {
+        const cv::Size window(params.cornerRefinementWinSize, params.cornerRefinementWinSize);
+        const cv::TermCriteria criteria(cv::TermCriteria::MAX_ITER | cv::TermCriteria::EPS,
+            params.cornerRefinementMaxIterations, params.cornerRefinementMinAccuracy);
+        for (auto& marker : corners) {
+            cv::cornerSubPix(gray, marker, window, cv::Size(-1, -1), criteria);
+        }
+    }
+}
+
+bool FastMarkerDetector::identify(const cv::Mat& onlyBits, int& id, int& rotation) const {
+    if (useCodeTable && codeTable.isValid()) {
+        return codeTable.identify(MarkerCodeTable::packBits(onlyBits), id, rotation);
+    }
+    // Dictionary::identify wants a continuous matrix
+    return dictionary.identify(onlyBits.clone(), id, rotation, params.errorCorrectionRate);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/objdetect/aruco_dictionary.hpp>
+#include <opencv2/objdetect/aruco_detector.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "MarkerCodeTable.hpp"
+#include "ThreadPool.hpp"
+
+// SIMD path the threshold kernel uses on this CPU: "AVX2", "NEON" or "scalar"
+const char* thresholdKernelName();
+
+// Mean adaptive threshold with a single window, computed from an integral image.
+// Produces the same image as
+// cv::adaptiveThreshold(gray, binary, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, winSize, constant).
+// integral is scratch memory that is reused between calls.
+void integralAdaptiveThreshold(const cv::Mat& gray, cv::Mat& binary, int winSize, double constant,
+    std::vector<uint32_t>& integral, bool useSimd = true);
+
+// Marker detection front end for a single fixed dictionary.
+// Thresholds once instead of once per window size, extracts quads from the contours and decodes them.
+// The result can be handed to CharucoDetector::detectBoard as markerCorners/markerIds.
+class FastMarkerDetector {
+public:
+    // Milliseconds spent in each stage during the last detectMarkers call
+    struct Timings {
+        double threshold = 0;
+        double candidates = 0;
+        double decode = 0;
+    };
+
+    FastMarkerDetector(const cv::aruco::Dictionary& dictionary,
+        const cv::aruco::DetectorParameters& params = cv::aruco::DetectorParameters(),
+        int thresholdWinSize = 13);
+
+    void detectMarkers(const cv::Mat& gray, std::vector<std::vector<cv::Point2f>>& corners, std::vector<int>& ids);
+
+    // Same detection split into overlapping tiles that are thresholded and searched on the pool.
+    // Tiles overlap by tileOverlap so they find the same markers as detectMarkers.
+    void detectMarkersTiled(const cv::Mat& gray, std::vector<std::vector<cv::Point2f>>& corners, std::vector<int>& ids,
+        ThreadPool& pool);
+
+    // Individual stages, exposed for benchmarking
+    void threshold(const cv::Mat& gray, cv::Mat& binary);
+    void findCandidates(const cv::Mat& binary, std::vector<std::vector<cv::Point2f>>& candidates) const;
+    void decodeCandidates(const cv::Mat& gray, const std::vector<std::vector<cv::Point2f>>& candidates,
+        std::vector<std::vector<cv::Point2f>>& corners, std::vector<int>& ids) const;
+
+    const Timings& lastTimings() const { return timings; }
+
+    // Takes effect with the next detection, must not be called while one is running
+    void setDetectorParameters(const cv::aruco::DetectorParameters& detectorParams);
+    const cv::aruco::DetectorParameters& getDetectorParameters() const { return params; }
+
+    // Replaces the code table built at construction with one saved by MarkerCodeTable::save
+    bool loadCodeTable(const std::string& path);
+    const MarkerCodeTable& getCodeTable() const { return codeTable; }
+
+    // Overlap that fits the largest marker maxMarkerPerimeterRate allows, plus minDistanceToBorder on both
+    // sides. With the default rate of 4 this covers the whole image and detectMarkersTiled uses a single tile,
+    // lower the rate for the tiles to split the work.
+    int tileOverlap(const cv::Size& imageSize) const;
+
+    int thresholdWinSize;
+    cv::Size tileGrid = cv::Size(4, 2);
+
+    // Identify markers through the code table, false uses Dictionary::identify
+    bool useCodeTable = true;
+
+private:
+    struct TileResult {
+        std::vector<uint32_t> integral;
+        cv::Mat binary;
+        std::vector<std::vector<cv::Point2f>> quads;
+        std::vector<double> perimeters;
+    };
+
+    void extractQuads(const cv::Mat& binary, int maxDimension, cv::Point2f offset,
+        std::vector<std::vector<cv::Point2f>>& quads, std::vector<double>& perimeters) const;
+    void removeNearCandidates(std::vector<std::vector<cv::Point2f>>& candidates, std::vector<double>& perimeters) const;
+    bool identify(const cv::Mat& onlyBits, int& id, int& rotation) const;
+
+    cv::aruco::Dictionary dictionary;
+    cv::aruco::DetectorParameters params;
+    std::vector<uint32_t> integral;
+    cv::Mat binary;
+    MarkerCodeTable codeTable;
+    std::vector<TileResult> tileResults;
+    Timings timings;
+};
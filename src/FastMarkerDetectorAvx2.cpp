@@ -0,0 +1,54 @@
+// AVX2 row kernel of integralAdaptiveThreshold, the only file built with AVX2 enabled.
+// It is only called after a runtime check, so it must not include headers with inline code that other
+// files use too (OpenCV, STL containers): the linker could pick this file's AVX2 copy for everyone.
+#if defined(FAST_MARKER_AVX2)
+
+#include <immintrin.h>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+    // One byte pattern per comparison mask
+    struct ExpandMask {
+        uint64_t bytes[256];
+
+        ExpandMask() {
+            for (int m = 0; m < 256; m++) {
+                bytes[m] = 0;
+                for (int bit = 0; bit < 8; bit++) {
+                    if (m & (1 << bit)) bytes[m] |= uint64_t(0xFF) << (8 * bit);
+                }
+            }
+        }
+    };
+}
+
+// Same comparison as thresholdPixel, 8 pixels per iteration. Returns how many pixels were done.
+int thresholdRowAvx2(const unsigned char* src, unsigned char* dst, int width, const uint32_t* top, const uint32_t* bottom,
+    int winSize, int idelta) {
+    static const ExpandMask expandMask;
+    const int area = winSize * winSize;
+
+    const __m256i vDelta = _mm256_set1_epi32(idelta);
+    const __m256i vTwoArea = _mm256_set1_epi32(2 * area);
+    const __m256i vArea = _mm256_set1_epi32(area);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i tl = _mm256_loadu_si256((const __m256i*)(top + x));
+        __m256i tr = _mm256_loadu_si256((const __m256i*)(top + x + winSize));
+        __m256i bl = _mm256_loadu_si256((const __m256i*)(bottom + x));
+        __m256i br = _mm256_loadu_si256((const __m256i*)(bottom + x + winSize));
+        __m256i sum = _mm256_sub_epi32(_mm256_add_epi32(br, tl), _mm256_add_epi32(bl, tr));
+
+        __m256i pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + x)));
+        __m256i lhs = _mm256_mullo_epi32(_mm256_add_epi32(pixels, vDelta), vTwoArea);
+        __m256i rhs = _mm256_add_epi32(_mm256_slli_epi32(sum, 1), vArea);
+        // lhs <= rhs is the complement of lhs > rhs
+        int greater = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(lhs, rhs)));
+        uint64_t bytes = expandMask.bytes[~greater & 0xFF];
+        std::memcpy(dst + x, &bytes, sizeof(bytes));
+    }
+    return x;
+}
+
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <opencv2/objdetect/aruco_detector.hpp>
+#include <sstream>
+#include <string>
+
+// Detection settings the governor trades against frame time
+struct GovernorSettings {
+    double detectionScale;      // Markers are searched on the image scaled by this
+    double roiMargin;           // Region around the last board, as a fraction of its size
+    int fullDetectionInterval;  // Frames between searches of the whole image, 1 = every frame
+    int thresholdWinSizeStep;   // DetectorParameters::adaptiveThreshWinSizeStep of the stock detector
+    int cornerRefinementMethod; // DetectorParameters::cornerRefinementMethod
+};
+
+// Keeps the work per frame within a target frame time by stepping through quality levels.
+// Work time is smoothed and has to stay over budget for a while before quality drops, and well
+// under budget for much longer before it comes back, so the level does not oscillate.
+class FrameGovernor {
+public:
+    explicit FrameGovernor(double targetFrameMs) : targetFrameMs(targetFrameMs) {
+    }
+
+    // Feed the cost of the last frame. Returns true when the level changed, see lastDecision().
+    bool update(double workMs, double detectionMs, double renderMs) {
+        smoothedMs = smoothedMs < 0 ? workMs : smoothedMs + smoothing * (workMs - smoothedMs);
+
+        if (smoothedMs > targetFrameMs) {
+            overBudgetFrames++;
+            underBudgetFrames = 0;
+        }
+        else if (smoothedMs < targetFrameMs * improveRatio) {
+            underBudgetFrames++;
+            overBudgetFrames = 0;
+        }
+        else {
+            overBudgetFrames = 0;
+            underBudgetFrames = 0;
+        }
+
+        int newLevel = currentLevel;
+        if (overBudgetFrames >= degradeAfterFrames && currentLevel < levelCount - 1) newLevel++;
+        if (underBudgetFrames >= improveAfterFrames && currentLevel > 0) newLevel--;
+        if (newLevel == currentLevel) return false;
+
+        std::ostringstream decision;
+        decision << "Governor: level " << currentLevel << " -> " << newLevel << ", work " << smoothedMs
+            << " ms for a " << targetFrameMs << " ms budget (detection " << detectionMs << " ms, render " << renderMs << " ms)";
+        lastDecisionText = decision.str();
+
+        currentLevel = newLevel;
+        overBudgetFrames = 0;
+        underBudgetFrames = 0;
+        return true;
+    }
+
+    const GovernorSettings& settings() const { return levels[currentLevel]; }
+    int level() const { return currentLevel; }
+    double smoothedWorkMs() const { return smoothedMs; }
+    double targetMs() const { return targetFrameMs; }
+    const std::string& lastDecision() const { return lastDecisionText; }
+
+    // Level 0 is full quality, the last level the cheapest
+    static constexpr int levelCount = 5;
+    static const GovernorSettings& levelSettings(int level) { return levels[level]; }
+
+private:
+    static constexpr GovernorSettings levels[levelCount] = {
+        // scale, ROI margin, full detection interval, threshold step, corner refinement
+        { 1.0,  0.50,  1, 10, cv::aruco::CORNER_REFINE_SUBPIX },
+        { 1.0,  0.50,  5, 10, cv::aruco::CORNER_REFINE_SUBPIX },
+        { 1.0,  0.35, 10, 20, cv::aruco::CORNER_REFINE_NONE },
+        { 0.75, 0.30, 15, 20, cv::aruco::CORNER_REFINE_NONE },
+        { 0.5,  0.25, 30, 20, cv::aruco::CORNER_REFINE_NONE },
+    };
+
+    const double smoothing = 0.1;
+    const double improveRatio = 0.7;
+    const int degradeAfterFrames = 15;
+    const int improveAfterFrames = 120;
+
+    double targetFrameMs;
+    double smoothedMs = -1;
+    int currentLevel = 0;
+    int overBudgetFrames = 0;
+    int underBudgetFrames = 0;
+    std::string lastDecisionText;
+};
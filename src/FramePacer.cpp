@@ -0,0 +1,63 @@
+#include "FramePacer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <timeapi.h>
+#endif
+
+namespace {
+    // Sleeps can end this much late, the rest of the wait is spent spinning
+    const double spinSeconds = 0.002;
+}
+
+FramePacer::FramePacer(double refreshPeriod, double margin, size_t historySize, double percentile)
+    : period(refreshPeriod), margin(margin), percentile(percentile), history(std::max<size_t>(historySize, 1), 0.0),
+    lastSwap(Clock::now()) {
+#ifdef _WIN32
+    timeBeginPeriod(1);
+#endif
+}
+
+FramePacer::~FramePacer() {
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
+}
+
+double FramePacer::waitForFrameStart() {
+    const Clock::time_point start = Clock::now();
+    double wait = period - prediction - margin - std::chrono::duration<double>(start - lastSwap).count();
+    // Never wait a whole refresh, e.g. when the swap returned without waiting for the vsync
+    wait = std::min(wait, period - margin);
+    if (wait <= 0) return 0;
+
+    const Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(wait));
+    if (wait > spinSeconds) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait - spinSeconds));
+    }
+    while (Clock::now() < end) {
+        std::this_thread::yield();
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void FramePacer::frameDone(double workSeconds) {
+    history[nextSample] = workSeconds;
+    nextSample = (nextSample + 1) % history.size();
+    samples = std::min(samples + 1, history.size());
+
+    std::vector<double> recent(history.begin(), history.begin() + std::ptrdiff_t(samples));
+    const size_t rank = std::min(samples - 1, size_t(percentile * double(samples)));
+    std::nth_element(recent.begin(), recent.begin() + std::ptrdiff_t(rank), recent.end());
+    prediction = recent[rank];
+}
+
+void FramePacer::swapped() {
+    lastSwap = Clock::now();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+// Late frame pacing for a vsynced render loop.
+// After a swap the loop waits until there is only just enough time left to do a frame's work before the
+// next vsync, so the camera frames it reads are as new as possible when they are shown. The work of a frame
+// is predicted from a high percentile of recent frames, so a rare slow frame (stats output, detector
+// reconfiguration) does not hold back every other frame.
+// The wait sleeps most of the way and spins the rest, as sleeps can overshoot by a timer tick. On Windows
+// the timer resolution is raised to 1 ms while a pacer exists.
+class FramePacer {
+public:
+    explicit FramePacer(double refreshPeriod, double margin = 0.002, size_t historySize = 120, double percentile = 0.9);
+    ~FramePacer();
+
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    // Before reading the cameras, returns the seconds waited
+    double waitForFrameStart();
+
+    // Seconds of CPU and GPU work of the frame that was just rendered, without waits for camera frames
+    void frameDone(double workSeconds);
+
+    // Right after the swap returns
+    void swapped();
+
+    void setRefreshPeriod(double seconds) { period = seconds; }
+    double refreshPeriod() const { return period; }
+    double predictedWork() const { return prediction; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    double period;
+    double margin;
+    double percentile;
+    std::vector<double> history;
+    size_t nextSample = 0;
+    size_t samples = 0;
+    double prediction = 0;
+    Clock::time_point lastSwap;
+};
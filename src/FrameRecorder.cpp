@@ -0,0 +1,197 @@
+#include "FrameRecorder.hpp"
+
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+FrameRecorder::FrameRecorder(const std::string& path, int width, int height, double fps,
+    int ringSize, size_t maxQueuedFrames)
+    : width(width), height(height), frameBytes(size_t(width) * height * 3), fps(fps), maxQueuedFrames(maxQueuedFrames) {
+    const std::string extension = std::filesystem::path(path).extension().string();
+    if (extension == ".y4m") {
+        y4m.open(path, std::ios::binary | std::ios::trunc);
+        y4m << "YUV4MPEG2 W" << width << " H" << height << " F" << cvRound(fps * 1000) << ":1000 Ip A1:1 C444 XCOLORRANGE=FULL\n";
+        open = bool(y4m);
+    }
+    else {
+        int fourcc = extension == ".mp4" ? cv::VideoWriter::fourcc('m', 'p', '4', 'v') : cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+        open = writer.open(path, fourcc, fps, cv::Size(width, height));
+    }
+    if (!open) {
+        std::cerr << "Failed to open recording: " << path << std::endl;
+        return;
+    }
+
+    ring.resize(std::max(ringSize, 1));
+    for (auto& slot : ring) {
+        glGenBuffers(1, &slot.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    encoder = std::thread(&FrameRecorder::encoderLoop, this);
+}
+
+FrameRecorder::~FrameRecorder() {
+    if (!open) return;
+
+    // Keep the last frames that are still in flight
+    for (size_t i = 0; i < ring.size(); i++) {
+        Slot& slot = ring[(nextSlot + i) % ring.size()];
+        if (slot.fence) collect(slot, true);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    frameReady.notify_all();
+    encoder.join();
+
+    for (auto& slot : ring) {
+        if (slot.fence) glDeleteSync(slot.fence);
+        glDeleteBuffers(1, &slot.pbo);
+    }
+    writer.release();
+}
+
+void FrameRecorder::capture(double time) {
+    if (!open) return;
+
+    // Hand finished readbacks to the encoder, oldest first. The GPU completes them in order,
+    // so the first unfinished one means the rest are not done either.
+    for (size_t i = 0; i < ring.size(); i++) {
+        Slot& slot = ring[(nextSlot + i) % ring.size()];
+        if (slot.fence && !collect(slot, false)) break;
+    }
+
+    // Slots of the file that have come due since the last frame, none when rendering faster than recording
+    if (startTime < 0) startTime = time;
+    int64_t due = int64_t(std::floor((time - startTime) * fps)) + 1;
+    if (due <= scheduledFrames) return;
+    pendingRepeats += int(due - scheduledFrames);
+    scheduledFrames = due;
+
+    // All buffers are still being read back, skip this frame rather than wait for the GPU
+    Slot& slot = ring[nextSlot];
+    if (slot.fence) {
+        std::lock_guard<std::mutex> lock(mutex);
+        dropped++;
+        return;
+    }
+    slot.repeats = pendingRepeats;
+    pendingRepeats = 0;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, 0); // Into the buffer, returns immediately
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    nextSlot = (nextSlot + 1) % ring.size();
+}
+
+int FrameRecorder::recordedFrames() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return recorded;
+}
+
+int FrameRecorder::droppedFrames() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dropped;
+}
+
+// Returns false if the readback of the slot has not finished yet
+bool FrameRecorder::collect(Slot& slot, bool wait) {
+    GLenum status = wait ?
+        glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) :
+        glClientWaitSync(slot.fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) return false;
+
+    glDeleteSync(slot.fence);
+    slot.fence = 0;
+
+    // Drop the frame when the encoder is too far behind, the next one fills its slots
+    cv::Mat frame;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (status == GL_WAIT_FAILED || queue.size() >= maxQueuedFrames) {
+            dropped++;
+            pendingRepeats += slot.repeats;
+            return true;
+        }
+        if (!freeFrames.empty()) {
+            frame = freeFrames.back();
+            freeFrames.pop_back();
+        }
+    }
+    if (frame.empty()) {
+        frame.create(height, width, CV_8UC3);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameBytes, GL_MAP_READ_BIT);
+    if (data) {
+        std::memcpy(frame.data, data, frameBytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!data) {
+            dropped++;
+            pendingRepeats += slot.repeats;
+            freeFrames.push_back(frame);
+            return true;
+        }
+        queue.push_back(QueuedFrame{ frame, slot.repeats });
+    }
+    frameReady.notify_one();
+    return true;
+}
+
+void FrameRecorder::encoderLoop() {
+    while (true) {
+        QueuedFrame frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frameReady.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            frame = queue.front();
+            queue.pop_front();
+        }
+
+        writeFrame(frame.image, frame.repeats);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        recorded += frame.repeats;
+        freeFrames.push_back(frame.image);
+    }
+}
+
+void FrameRecorder::writeFrame(const cv::Mat& frame, int repeats) {
+    // OpenGL rows start at the bottom
+    cv::Mat image;
+    cv::flip(frame, image, 0);
+
+    if (y4m.is_open()) {
+        // C444 is Y, Cb, Cr, OpenCV's order is Y, Cr, Cb
+        cv::cvtColor(image, yuv, cv::COLOR_BGR2YCrCb);
+        cv::split(yuv, planes);
+        for (int i = 0; i < repeats; i++) {
+            y4m << "FRAME\n";
+            for (int plane : { 0, 2, 1 }) {
+                y4m.write(reinterpret_cast<const char*>(planes[plane].data), std::streamsize(planes[plane].total()));
+            }
+        }
+    }
+    else {
+        for (int i = 0; i < repeats; i++) {
+            writer.write(image);
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records the rendered framebuffer without stalling the render loop.
+// Each frame is read back into the next pixel buffer object of a ring, guarded by a fence. A readback is
+// collected a few frames later once its fence has signalled and then encoded on a background thread.
+// When the GPU or the encoder cannot keep up, frames are dropped instead of blocking.
+// Frames are taken at the fixed rate of the file, whatever the render rate. A frame is repeated for every
+// slot the renderer or a dropped frame missed, so recordings play back at real speed.
+// Files ending in .y4m are written as raw full range 4:4:4 YUV4MPEG2, anything else goes through cv::VideoWriter.
+class FrameRecorder {
+public:
+    FrameRecorder(const std::string& path, int width, int height, double fps,
+        int ringSize = 3, size_t maxQueuedFrames = 8);
+    ~FrameRecorder();
+
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+    bool isOpen() const { return open; }
+    int frameWidth() const { return width; }
+    int frameHeight() const { return height; }
+
+    // Call once per frame after rendering and before swapping buffers, with the GL context current.
+    // time is in seconds, only frames due at the recording rate are read back.
+    void capture(double time);
+
+    int recordedFrames() const;
+    int droppedFrames() const;
+
+private:
+    struct Slot {
+        GLuint pbo = 0;
+        GLsync fence = 0;
+        int repeats = 0; // Frame slots of the file this readback fills
+    };
+
+    struct QueuedFrame {
+        cv::Mat image;
+        int repeats;
+    };
+
+    bool collect(Slot& slot, bool wait);
+    void encoderLoop();
+    void writeFrame(const cv::Mat& frame, int repeats);
+
+    int width, height;
+    size_t frameBytes;
+    double fps;
+    bool open = false;
+
+    // Fixed rate schedule, render thread only
+    double startTime = -1;
+    int64_t scheduledFrames = 0;
+    int pendingRepeats = 0; // Slots of frames that were due but dropped, filled by the next frame
+
+    std::vector<Slot> ring;
+    size_t nextSlot = 0;
+
+    cv::VideoWriter writer;
+    std::ofstream y4m;
+    cv::Mat yuv, planes[3];
+
+    std::thread encoder;
+    mutable std::mutex mutex;
+    std::condition_variable frameReady;
+    std::deque<QueuedFrame> queue;
+    std::vector<cv::Mat> freeFrames;
+    size_t maxQueuedFrames;
+    bool stopping = false;
+    int recorded = 0;
+    int dropped = 0;
+};
@@ -0,0 +1,59 @@
+#include "GpuTimer.hpp"
+
+#include <algorithm>
+
+GpuTimer::GpuTimer(int ringSize) : ring(size_t(std::max(ringSize, 1))) {
+    for (auto& query : ring) {
+        glGenQueries(1, &query.id);
+    }
+}
+
+GpuTimer::~GpuTimer() {
+    for (auto& query : ring) {
+        glDeleteQueries(1, &query.id);
+    }
+}
+
+void GpuTimer::begin() {
+    collect();
+
+    // Reusing a query that has no result yet would wait for it
+    if (ring[next].pending) return;
+    glBeginQuery(GL_TIME_ELAPSED, ring[next].id);
+    active = true;
+}
+
+void GpuTimer::end() {
+    if (!active) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    ring[next].pending = true;
+    next = (next + 1) % ring.size();
+    active = false;
+}
+
+double GpuTimer::takeAverageMs() {
+    collect();
+    double average = finished > 0 ? totalMs / finished : -1;
+    totalMs = 0;
+    finished = 0;
+    return average;
+}
+
+void GpuTimer::collect() {
+    // Oldest first, the GPU finishes them in order
+    for (size_t i = 0; i < ring.size(); i++) {
+        Query& query = ring[(next + i) % ring.size()];
+        if (!query.pending) continue;
+
+        GLint available = 0;
+        glGetQueryObjectiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &elapsedNs);
+        query.pending = false;
+        lastMs = double(elapsedNs) / 1e6;
+        totalMs += lastMs;
+        finished++;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <vector>
+
+// Measures the GPU time of a render pass with GL_TIME_ELAPSED queries.
+// Queries go round a ring and their results are picked up once the GPU reports them available,
+// usually a frame or two later, so reading them never waits on the GPU. When every query is still
+// in flight the pass is not timed that frame. Only one pass can be timed at a time.
+class GpuTimer {
+public:
+    explicit GpuTimer(int ringSize = 4);
+    ~GpuTimer();
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    // Around the GL calls of the pass, with the GL context current
+    void begin();
+    void end();
+
+    // Mean GPU milliseconds of the passes finished since the last call, -1 if none finished
+    double takeAverageMs();
+
+    // GPU milliseconds of the last finished pass, -1 before the first one
+    double latestMs() const { return lastMs; }
+
+private:
+    struct Query {
+        GLuint id = 0;
+        bool pending = false;
+    };
+
+    void collect();
+
+    std::vector<Query> ring;
+    size_t next = 0;
+    bool active = false;
+    double lastMs = -1;
+    double totalMs = 0;
+    int finished = 0;
+};
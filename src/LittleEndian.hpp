@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Numbers in the binary caches (calibration, marker code table) are stored little-endian whatever the host
+
+inline bool hostIsLittleEndian() {
+    const uint16_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+// Unsigned integer with the bytes of T
+template <typename T>
+using LittleEndianBits = std::conditional_t<sizeof(T) == 8, uint64_t,
+    std::conditional_t<sizeof(T) == 4, uint32_t, std::conditional_t<sizeof(T) == 2, uint16_t, uint8_t>>>;
+
+template <typename T>
+void appendLittleEndian(std::vector<char>& buffer, const T& value) {
+    static_assert(std::is_arithmetic_v<T> && sizeof(T) <= 8, "numbers only");
+    LittleEndianBits<T> bits;
+    std::memcpy(&bits, &value, sizeof(T));
+    for (size_t i = 0; i < sizeof(T); i++) {
+        buffer.push_back(char(uint8_t(uint64_t(bits) >> (8 * i))));
+    }
+}
+
+// Reads from position up to end, every read fails instead of passing end
+struct LittleEndianReader {
+    const std::vector<char>& buffer;
+    size_t end;
+    size_t position = 0;
+
+    bool read(void* destination, size_t size) {
+        if (end - position < size) return false;
+        if (size > 0) std::memcpy(destination, buffer.data() + position, size);
+        position += size;
+        return true;
+    }
+
+    template <typename T>
+    bool read(T& value) {
+        static_assert(std::is_arithmetic_v<T> && sizeof(T) <= 8, "numbers only");
+        if (end - position < sizeof(T)) return false;
+        LittleEndianBits<T> bits = 0;
+        for (size_t i = 0; i < sizeof(T); i++) {
+            bits |= LittleEndianBits<T>(uint64_t(uint8_t(buffer[position + i])) << (8 * i));
+        }
+        std::memcpy(&value, &bits, sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+};
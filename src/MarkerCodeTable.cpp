@@ -0,0 +1,218 @@
+#include "MarkerCodeTable.hpp"
+#include "LittleEndian.hpp"
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+    const char tableMagic[4] = { 'V', 'C', 'M', 'T' };
+    const uint32_t tableVersion = 1;
+
+    // Chunks of up to this many bits, so a chunk index has at most 4096 buckets
+    const int maxChunkBits = 12;
+
+    int popcount(uint64_t x) {
+#ifdef _MSC_VER
+        return int(__popcnt64(x));
+#else
+        return __builtin_popcountll(x);
+#endif
+    }
+
+    // FNV-1a, same as the calibration files
+    uint64_t checksum(const char* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+        for (size_t i = 0; i < size; i++) {
+            hash ^= uint8_t(data[i]);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    uint64_t hashDictionary(const cv::aruco::Dictionary& dictionary, int radius) {
+        std::vector<char> header;
+        appendLittleEndian(header, int32_t(dictionary.markerSize));
+        appendLittleEndian(header, int32_t(dictionary.maxCorrectionBits));
+        appendLittleEndian(header, int32_t(radius));
+        uint64_t hash = checksum(header.data(), header.size());
+        const cv::Mat& bytes = dictionary.bytesList;
+        for (int y = 0; y < bytes.rows; y++) {
+            hash = checksum(bytes.ptr<char>(y), bytes.cols * bytes.elemSize(), hash);
+        }
+        return hash;
+    }
+
+    bool fail(const std::string& path, const std::string& reason) {
+        std::cerr << "Invalid marker code table " << path << ": " << reason << std::endl;
+        return false;
+    }
+}
+
+MarkerCodeTable::MarkerCodeTable(const cv::aruco::Dictionary& dictionary, double errorCorrectionRate) {
+    if (dictionary.markerSize * dictionary.markerSize > 64) return;
+    markerSize = dictionary.markerSize;
+    radius = int(double(dictionary.maxCorrectionBits) * errorCorrectionRate);
+    dictionaryHash = hashDictionary(dictionary, radius);
+
+    // Let the dictionary itself name the rotation of every orientation, so the numbering matches identify
+    for (int m = 0; m < dictionary.bytesList.rows; m++) {
+        cv::Mat bits = cv::aruco::Dictionary::getBitsFromByteList(dictionary.bytesList.rowRange(m, m + 1), markerSize);
+        for (int k = 0; k < 4; k++) {
+            int id, rotation;
+            if (dictionary.identify(bits, id, rotation, 0.0)) {
+                codes.push_back(Code{ packBits(bits), uint32_t(id), uint32_t(rotation) });
+            }
+            cv::rotate(bits, bits, cv::ROTATE_90_CLOCKWISE);
+        }
+    }
+    buildIndex();
+}
+
+uint64_t MarkerCodeTable::packBits(const cv::Mat& bits) {
+    uint64_t packed = 0;
+    int bit = 0;
+    for (int y = 0; y < bits.rows; y++) {
+        const uchar* row = bits.ptr<uchar>(y);
+        for (int x = 0; x < bits.cols; x++, bit++) {
+            if (row[x]) packed |= uint64_t(1) << bit;
+        }
+    }
+    return packed;
+}
+
+void MarkerCodeTable::buildIndex() {
+    chunks.clear();
+    const int totalBits = markerSize * markerSize;
+    if (codes.empty() || totalBits == 0) return;
+
+    // One more chunk than errors allowed, and small enough to index directly
+    int count = std::max(radius + 1, (totalBits + maxChunkBits - 1) / maxChunkBits);
+    count = std::min(count, totalBits);
+
+    int shift = 0;
+    for (int c = 0; c < count; c++) {
+        int width = totalBits / count + (c < totalBits % count ? 1 : 0);
+        Chunk chunk;
+        chunk.shift = shift;
+        chunk.mask = (uint64_t(1) << width) - 1;
+        shift += width;
+
+        // Counting sort of the codes by their value in this chunk
+        chunk.offsets.assign(size_t(chunk.mask) + 2, 0);
+        for (const auto& code : codes) {
+            chunk.offsets[((code.bits >> chunk.shift) & chunk.mask) + 1]++;
+        }
+        for (size_t v = 1; v < chunk.offsets.size(); v++) {
+            chunk.offsets[v] += chunk.offsets[v - 1];
+        }
+        chunk.entries.resize(codes.size());
+        std::vector<uint32_t> next(chunk.offsets.begin(), chunk.offsets.end() - 1);
+        for (size_t i = 0; i < codes.size(); i++) {
+            chunk.entries[next[(codes[i].bits >> chunk.shift) & chunk.mask]++] = uint32_t(i);
+        }
+        chunks.push_back(std::move(chunk));
+    }
+}
+
+bool MarkerCodeTable::identify(uint64_t bits, int& id, int& rotation) const {
+    // Dictionary::identify takes the lowest id within the radius, then its closest rotation, the lowest one on ties.
+    // A code can sit in the bucket of several chunks, seeing it twice does not change the result.
+    int bestId = -1, bestRotation = 0, bestDistance = 0;
+    for (const auto& chunk : chunks) {
+        uint64_t key = (bits >> chunk.shift) & chunk.mask;
+        for (uint32_t e = chunk.offsets[key]; e < chunk.offsets[key + 1]; e++) {
+            const Code& code = codes[chunk.entries[e]];
+            int distance = popcount(bits ^ code.bits);
+            if (distance > radius) continue;
+
+            int codeId = int(code.id), codeRotation = int(code.rotation);
+            bool better = bestId < 0 || codeId < bestId || (codeId == bestId &&
+                (distance < bestDistance || (distance == bestDistance && codeRotation < bestRotation)));
+            if (better) {
+                bestId = codeId;
+                bestRotation = codeRotation;
+                bestDistance = distance;
+            }
+        }
+    }
+    if (bestId < 0) return false;
+    id = bestId;
+    rotation = bestRotation;
+    return true;
+}
+
+bool MarkerCodeTable::save(const std::string& path) const {
+    std::vector<char> buffer(tableMagic, tableMagic + sizeof(tableMagic));
+    appendLittleEndian(buffer, tableVersion);
+    appendLittleEndian(buffer, int32_t(markerSize));
+    appendLittleEndian(buffer, int32_t(radius));
+    appendLittleEndian(buffer, dictionaryHash);
+    appendLittleEndian(buffer, uint32_t(codes.size()));
+    for (const auto& code : codes) {
+        appendLittleEndian(buffer, code.bits);
+        appendLittleEndian(buffer, code.id);
+        appendLittleEndian(buffer, code.rotation);
+    }
+    appendLittleEndian(buffer, checksum(buffer.data(), buffer.size()));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.write(buffer.data(), std::streamsize(buffer.size()))) {
+        std::cerr << "Failed to write marker code table: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool MarkerCodeTable::load(const std::string& path, const cv::aruco::Dictionary& dictionary, double errorCorrectionRate) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "Marker code table not found: " << path << std::endl;
+        return false;
+    }
+    std::vector<char> buffer(size_t(file.tellg()));
+    file.seekg(0);
+    if (!file.read(buffer.data(), std::streamsize(buffer.size()))) return fail(path, "read error");
+
+    uint64_t storedChecksum;
+    if (buffer.size() < sizeof(tableMagic) + sizeof(storedChecksum)) return fail(path, "file too short");
+    const size_t end = buffer.size() - sizeof(storedChecksum);
+    LittleEndianReader checksumReader{ buffer, buffer.size(), end };
+    checksumReader.read(storedChecksum);
+    if (storedChecksum != checksum(buffer.data(), end)) return fail(path, "checksum mismatch");
+    if (std::memcmp(buffer.data(), tableMagic, sizeof(tableMagic)) != 0) return fail(path, "not a marker code table");
+
+    LittleEndianReader reader{ buffer, end, sizeof(tableMagic) };
+    uint32_t version, count;
+    int32_t size, storedRadius;
+    uint64_t hash;
+    bool ok = reader.read(version) && reader.read(size) && reader.read(storedRadius) && reader.read(hash) && reader.read(count);
+    if (!ok) return fail(path, "truncated header");
+    if (version != tableVersion) return fail(path, "unsupported version");
+
+    const int expectedRadius = int(double(dictionary.maxCorrectionBits) * errorCorrectionRate);
+    if (size != dictionary.markerSize || storedRadius != expectedRadius || hash != hashDictionary(dictionary, expectedRadius)) {
+        return fail(path, "made for another dictionary or error correction rate");
+    }
+    if (count > uint32_t(dictionary.bytesList.rows) * 4) return fail(path, "too many codes");
+
+    std::vector<Code> loaded(count);
+    for (auto& code : loaded) {
+        ok = reader.read(code.bits) && reader.read(code.id) && reader.read(code.rotation);
+        if (!ok) return fail(path, "truncated codes");
+        if (code.id >= uint32_t(dictionary.bytesList.rows) || code.rotation > 3) return fail(path, "code out of range");
+    }
+    if (reader.position != reader.end) return fail(path, "trailing data");
+
+    markerSize = size;
+    radius = storedRadius;
+    dictionaryHash = hash;
+    codes = std::move(loaded);
+    buildIndex();
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/objdetect/aruco_dictionary.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Marker identification in constant time for dictionaries of up to 8x8 bits.
+// Dictionary::identify compares a candidate against every marker in all four rotations. This table
+// holds every marker code in every rotation, indexed by r + 1 disjoint chunks of its bits, where r is
+// the correction radius. A code within r bit errors of a marker leaves at least one chunk untouched,
+// so looking up the candidate's own chunks finds every marker it could be, usually only a handful.
+// Gives the same id and rotation as Dictionary::identify with the same error correction rate.
+class MarkerCodeTable {
+public:
+    MarkerCodeTable() = default;
+    MarkerCodeTable(const cv::aruco::Dictionary& dictionary, double errorCorrectionRate);
+
+    // False for dictionaries with markers over 64 bits
+    bool isValid() const { return !codes.empty(); }
+    int correctionRadius() const { return radius; }
+    size_t codeCount() const { return codes.size(); }
+
+    // 0/1 cells row by row, the first cell in bit 0
+    static uint64_t packBits(const cv::Mat& bits);
+
+    bool identify(uint64_t bits, int& id, int& rotation) const;
+
+    bool save(const std::string& path) const;
+
+    // Fails if the file is broken or was made for another dictionary or error correction rate
+    bool load(const std::string& path, const cv::aruco::Dictionary& dictionary, double errorCorrectionRate);
+
+private:
+    struct Code {
+        uint64_t bits;
+        uint32_t id;
+        uint32_t rotation;
+    };
+
+    // Indices into codes grouped by the value of some of their bits
+    struct Chunk {
+        int shift;
+        uint64_t mask;
+        std::vector<uint32_t> offsets; // Bucket of value v is entries[offsets[v], offsets[v + 1])
+        std::vector<uint32_t> entries;
+    };
+
+    void buildIndex();
+
+    int markerSize = 0;
+    int radius = 0;
+    uint64_t dictionaryHash = 0;
+    std::vector<Code> codes;
+    std::vector<Chunk> chunks;
+};
@@ -0,0 +1,505 @@
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/objdetect/aruco_detector.hpp>
+#include <opencv2/objdetect/charuco_detector.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "CalibrationStore.hpp"
+#include "FastMarkerDetector.hpp"
+#include "FrameGovernor.hpp"
+#include "ThreadPool.hpp"
+
+// Ground truth accuracy and speed checks for calibration and pose estimation.
+// Renders the 5x7 ChArUco board of Calibration.cpp and App.cpp through a known camera with distortion,
+// from known poses, with blur and noise. Calibrates on the renders the way Calibration.cpp does, and
+// estimates poses the way App.cpp does, with its tiled detection at the best and the cheapest governor
+// level. Everything is seeded, so two runs produce the same images.
+//
+// Exits with 1 when a metric is over its limit, or worse than the baseline given with --baseline by more
+// than --tolerance (a fraction, 0.25 by default). --no-times skips timing regressions, for baselines from
+// another machine. --save-baseline <file> writes the metrics of this run for later comparison.
+
+namespace {
+    const int supersampling = 2;
+
+    struct Camera {
+        cv::Mat K; // 3x3 CV_64F
+        cv::Mat D; // 1x5 CV_64F
+        cv::Size size;
+    };
+
+    struct Condition {
+        const char* name;
+        double noiseSigma; // Grey levels
+        double blurSigma;  // Pixels, 0 for none
+        double limitScale; // Accuracy limits are multiplied by this
+    };
+
+    struct Metric {
+        std::string name;
+        double value;
+        double limit;         // Hard limit, negative for none
+        bool higherIsBetter;
+        bool isTime;
+    };
+
+    // Everything needed to render views of the board
+    struct Scene {
+        cv::aruco::CharucoBoard board;
+        cv::Mat boardImage;
+        double pixelsPerMetre;
+        int margin;
+        cv::Mat background;  // Supersampled
+        cv::Mat pinholeMap;  // Supersampled, CV_32FC2, undistorted pixel of every distorted pixel
+    };
+
+    double elapsedMs(int64 start) {
+        return double(cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+    }
+
+    double median(std::vector<double> values) {
+        if (values.empty()) return 0;
+        std::nth_element(values.begin(), values.begin() + std::ptrdiff_t(values.size() / 2), values.end());
+        return values[values.size() / 2];
+    }
+
+    Scene makeScene(const cv::aruco::CharucoBoard& board, const Camera& camera) {
+        Scene scene{ board };
+        cv::Size2f boardSize(board.getChessboardSize().width * board.getSquareLength(),
+            board.getChessboardSize().height * board.getSquareLength());
+
+        // Fine enough that the closest views are not magnified
+        scene.pixelsPerMetre = 6000;
+        scene.margin = 60;
+        cv::Size imageSize(cvRound(boardSize.width * scene.pixelsPerMetre) + 2 * scene.margin,
+            cvRound(boardSize.height * scene.pixelsPerMetre) + 2 * scene.margin);
+        board.generateImage(imageSize, scene.boardImage, scene.margin, 1);
+
+        // Clutter behind the board, the same for every view
+        cv::Size superSize(camera.size.width * supersampling, camera.size.height * supersampling);
+        cv::RNG rng(4321);
+        scene.background.create(superSize, CV_8UC1);
+        rng.fill(scene.background, cv::RNG::UNIFORM, 60, 200);
+        cv::GaussianBlur(scene.background, scene.background, cv::Size(0, 0), 6);
+        for (int i = 0; i < 80; i++) {
+            cv::Point p(rng.uniform(0, superSize.width), rng.uniform(0, superSize.height));
+            cv::Size s(rng.uniform(20, 160), rng.uniform(20, 160));
+            cv::rectangle(scene.background, cv::Rect(p, s), cv::Scalar(rng.uniform(0, 80)), cv::FILLED);
+        }
+
+        // Distortion is the same for every view, so find the undistorted position of every subpixel once
+        std::vector<cv::Point2d> distorted;
+        distorted.reserve(size_t(superSize.area()));
+        for (int y = 0; y < superSize.height; y++) {
+            for (int x = 0; x < superSize.width; x++) {
+                distorted.push_back(cv::Point2d((x + 0.5) / supersampling - 0.5, (y + 0.5) / supersampling - 0.5));
+            }
+        }
+        std::vector<cv::Point2d> undistorted;
+        cv::undistortPoints(distorted, undistorted, camera.K, camera.D, cv::noArray(), camera.K,
+            cv::TermCriteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 50, 1e-10));
+        cv::Mat(undistorted).reshape(2, superSize.height).convertTo(scene.pinholeMap, CV_32FC2);
+        return scene;
+    }
+
+    // Board seen from the given pose, at camera resolution
+    cv::Mat renderView(const Scene& scene, const Camera& camera, const cv::Mat& rvec, const cv::Mat& tvec,
+        const Condition& condition, cv::RNG& rng) {
+        cv::Mat R;
+        cv::Rodrigues(rvec, R);
+        cv::Mat planeToCamera(3, 3, CV_64F);
+        R.col(0).copyTo(planeToCamera.col(0));
+        R.col(1).copyTo(planeToCamera.col(1));
+        tvec.reshape(1, 3).copyTo(planeToCamera.col(2));
+
+        // Undistorted pixel -> board plane in metres -> board image pixel
+        cv::Mat planeToImage = (cv::Mat_<double>(3, 3) <<
+            scene.pixelsPerMetre, 0, scene.margin - 0.5,
+            0, scene.pixelsPerMetre, scene.margin - 0.5,
+            0, 0, 1);
+        cv::Matx33d pixelToBoard(cv::Mat(planeToImage * (camera.K * planeToCamera).inv()));
+
+        cv::Mat map(scene.pinholeMap.size(), CV_32FC2);
+        for (int y = 0; y < map.rows; y++) {
+            const cv::Point2f* in = scene.pinholeMap.ptr<cv::Point2f>(y);
+            cv::Point2f* out = map.ptr<cv::Point2f>(y);
+            for (int x = 0; x < map.cols; x++) {
+                cv::Vec3d q = pixelToBoard * cv::Vec3d(in[x].x, in[x].y, 1.0);
+                // Rays hitting the plane behind the camera
+                out[x] = q[2] > 0 ? cv::Point2f(float(q[0] / q[2]), float(q[1] / q[2])) : cv::Point2f(-1e6f, -1e6f);
+            }
+        }
+
+        cv::Mat super = scene.background.clone();
+        cv::remap(scene.boardImage, super, map, cv::noArray(), cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+
+        cv::Mat frame;
+        cv::resize(super, frame, camera.size, 0, 0, cv::INTER_AREA);
+        if (condition.blurSigma > 0) {
+            cv::GaussianBlur(frame, frame, cv::Size(0, 0), condition.blurSigma);
+        }
+        if (condition.noiseSigma > 0) {
+            cv::Mat noise(frame.size(), CV_16SC1);
+            rng.fill(noise, cv::RNG::NORMAL, 0, condition.noiseSigma);
+            cv::Mat noisy;
+            frame.convertTo(noisy, CV_16SC1);
+            noisy += noise;
+            noisy.convertTo(frame, CV_8UC1);
+        }
+        return frame;
+    }
+
+    // Random pose with the whole board in view, tilted up to maxTiltDegrees
+    void samplePose(const Scene& scene, const Camera& camera, cv::RNG& rng, double minDistance, double maxDistance,
+        double maxTiltDegrees, cv::Mat& rvec, cv::Mat& tvec) {
+        const double toRadians = CV_PI / 180.0;
+        cv::Size2f boardSize(scene.board.getChessboardSize().width * scene.board.getSquareLength(),
+            scene.board.getChessboardSize().height * scene.board.getSquareLength());
+        const std::vector<cv::Point3d> outline = {
+            {0, 0, 0}, {boardSize.width, 0, 0}, {boardSize.width, boardSize.height, 0}, {0, boardSize.height, 0} };
+        const cv::Point3d center(boardSize.width / 2, boardSize.height / 2, 0);
+        const int border = 20;
+
+        while (true) {
+            cv::Mat tilt, spin;
+            cv::Rodrigues(cv::Vec3d(rng.uniform(-maxTiltDegrees, maxTiltDegrees) * toRadians,
+                rng.uniform(-maxTiltDegrees, maxTiltDegrees) * toRadians, 0), tilt);
+            cv::Rodrigues(cv::Vec3d(0, 0, rng.uniform(-30.0, 30.0) * toRadians), spin);
+            cv::Mat R = tilt * spin;
+
+            // Put the board centre on a random pixel at a random distance
+            double distance = rng.uniform(minDistance, maxDistance);
+            cv::Mat pixel = (cv::Mat_<double>(3, 1) << rng.uniform(0.35, 0.65) * camera.size.width,
+                rng.uniform(0.35, 0.65) * camera.size.height, 1.0);
+            cv::Mat t = distance * camera.K.inv() * pixel - R * cv::Mat(center);
+
+            cv::Rodrigues(R, rvec);
+            tvec = t;
+            std::vector<cv::Point2d> projected;
+            cv::projectPoints(outline, rvec, tvec, camera.K, camera.D, projected);
+            bool inView = true;
+            for (const auto& p : projected) {
+                if (p.x < border || p.y < border || p.x > camera.size.width - border || p.y > camera.size.height - border) {
+                    inView = false;
+                }
+            }
+            if (inView) return;
+        }
+    }
+
+    double rotationErrorDegrees(const cv::Mat& rvecEstimate, const cv::Mat& rvecTruth) {
+        cv::Mat estimate, truth;
+        cv::Rodrigues(rvecEstimate, estimate);
+        cv::Rodrigues(rvecTruth, truth);
+        cv::Mat difference = estimate * truth.t();
+        double cosine = std::max(-1.0, std::min(1.0, (cv::trace(difference)[0] - 1.0) / 2.0));
+        return std::acos(cosine) * 180.0 / CV_PI;
+    }
+
+    // Largest distance between where the true and the estimated model put a pixel once undistorted
+    double modelErrorPixels(const Camera& truth, const cv::Mat& K, const cv::Mat& D) {
+        std::vector<cv::Point2d> grid;
+        for (int y = 0; y <= 18; y++) {
+            for (int x = 0; x <= 32; x++) {
+                grid.push_back(cv::Point2d((0.05 + 0.9 * x / 32.0) * truth.size.width, (0.05 + 0.9 * y / 18.0) * truth.size.height));
+            }
+        }
+        std::vector<cv::Point2d> expected, estimated;
+        cv::undistortPoints(grid, expected, truth.K, truth.D, cv::noArray(), truth.K);
+        cv::undistortPoints(grid, estimated, K, D, cv::noArray(), truth.K);
+        double worst = 0;
+        for (size_t i = 0; i < grid.size(); i++) {
+            worst = std::max(worst, cv::norm(expected[i] - estimated[i]));
+        }
+        return worst;
+    }
+
+    void report(std::vector<Metric>& metrics, const std::string& name, double value, double limit,
+        bool higherIsBetter = false, bool isTime = false) {
+        metrics.push_back(Metric{ name, value, limit, higherIsBetter, isTime });
+        std::cout << "  " << std::left << std::setw(44) << name << std::right << std::setw(10) << value;
+        if (limit >= 0) std::cout << (higherIsBetter ? "  (min " : "  (max ") << limit << ")";
+        std::cout << std::endl;
+    }
+
+    // Calibration.cpp: stock ChArUco detection on the distorted images, then calibrateCamera
+    void runCalibration(const Scene& scene, const Camera& camera, const Condition& condition, std::vector<Metric>& metrics) {
+        struct FlagSet {
+            const char* name;
+            int flags;
+            double maxModelErrorPixels;
+        };
+        const FlagSet flagSets[] = {
+            { "default", 0, 1.0 },
+            { "fix_k3", cv::CALIB_FIX_K3, 1.5 },
+            { "zero_tangent", cv::CALIB_ZERO_TANGENT_DIST, 2.0 },
+            { "fix_aspect", cv::CALIB_FIX_ASPECT_RATIO, 1.0 },
+            { "rational", cv::CALIB_RATIONAL_MODEL, 1.5 },
+        };
+
+        cv::aruco::CharucoDetector charucoDetector(scene.board);
+        cv::RNG rng(1000);
+        const int views = 25;
+        std::vector<std::vector<cv::Point3f>> allObjectPoints;
+        std::vector<std::vector<cv::Point2f>> allImagePoints;
+        for (int i = 0; i < views; i++) {
+            cv::Mat rvec, tvec;
+            samplePose(scene, camera, rng, 0.5, 0.9, 45, rvec, tvec);
+            cv::Mat image = renderView(scene, camera, rvec, tvec, condition, rng);
+
+            std::vector<cv::Point2f> charucoCorners;
+            std::vector<int> charucoIds;
+            charucoDetector.detectBoard(image, charucoCorners, charucoIds);
+            if (charucoIds.size() < 4) continue;
+
+            std::vector<cv::Point3f> objectPoints;
+            std::vector<cv::Point2f> imagePoints;
+            scene.board.matchImagePoints(charucoCorners, charucoIds, objectPoints, imagePoints);
+            allObjectPoints.push_back(objectPoints);
+            allImagePoints.push_back(imagePoints);
+        }
+
+        const std::string prefix = std::string("calibration_") + condition.name + "_";
+        std::cout << "\n=== Calibration, " << condition.name << " ===" << std::endl;
+        report(metrics, prefix + "views_used", double(allObjectPoints.size()) / views, 0.9, true);
+        if (allObjectPoints.size() < 5) return;
+
+        const double fx = camera.K.at<double>(0, 0), fy = camera.K.at<double>(1, 1);
+        const double cx = camera.K.at<double>(0, 2), cy = camera.K.at<double>(1, 2);
+        for (const auto& flagSet : flagSets) {
+            cv::Mat K = cv::Mat::eye(3, 3, CV_64F), D;
+            std::vector<cv::Mat> rvecs, tvecs;
+            int64 start = cv::getTickCount();
+            double rms = cv::calibrateCamera(allObjectPoints, allImagePoints, camera.size, K, D, rvecs, tvecs, flagSet.flags);
+            double ms = elapsedMs(start);
+
+            const std::string name = prefix + flagSet.name + "_";
+            double focalError = 100.0 * std::max(std::abs(K.at<double>(0, 0) - fx) / fx, std::abs(K.at<double>(1, 1) - fy) / fy);
+            double principalError = std::max(std::abs(K.at<double>(0, 2) - cx), std::abs(K.at<double>(1, 2) - cy));
+            report(metrics, name + "rms_px", rms, 1.0 * condition.limitScale);
+            report(metrics, name + "focal_error_pct", focalError, 1.0 * condition.limitScale);
+            report(metrics, name + "principal_error_px", principalError, 10.0 * condition.limitScale);
+            report(metrics, name + "model_error_px", modelErrorPixels(camera, K, D), flagSet.maxModelErrorPixels * condition.limitScale);
+            report(metrics, name + "ms", ms, -1, false, true);
+        }
+    }
+
+    // App.cpp: undistort, tiled fast marker front end with the settings of a governor level, ChArUco interpolation,
+    // then solvePnP with each method. Every frame is a full detection, like the first frame of a stream.
+    void runPose(const Scene& scene, const Camera& camera, const Condition& condition, int level, ThreadPool& pool,
+        std::vector<Metric>& metrics) {
+        struct Method {
+            const char* name;
+            int flag;
+            double maxRotationDegrees;
+            double maxTranslationMm;
+        };
+        const Method methods[] = {
+            { "iterative", cv::SOLVEPNP_ITERATIVE, 0.5, 8.0 },
+            { "epnp", cv::SOLVEPNP_EPNP, 2.0, 20.0 },
+            { "ippe", cv::SOLVEPNP_IPPE, 0.5, 8.0 },
+            { "sqpnp", cv::SOLVEPNP_SQPNP, 0.5, 8.0 },
+        };
+        const int methodCount = int(sizeof(methods) / sizeof(methods[0]));
+
+        CameraCalibration calibration;
+        calibration.cameraMatrix = camera.K;
+        calibration.distortionCoefficients = camera.D;
+        buildUndistortMap(calibration, camera.size);
+
+        const GovernorSettings& quality = FrameGovernor::levelSettings(level);
+        cv::aruco::DetectorParameters detectorParams;
+        detectorParams.adaptiveThreshWinSizeStep = quality.thresholdWinSizeStep;
+        detectorParams.cornerRefinementMethod = quality.cornerRefinementMethod;
+        cv::aruco::CharucoDetector charucoDetector(scene.board, cv::aruco::CharucoParameters(), detectorParams);
+        FastMarkerDetector fastDetector(scene.board.getDictionary(), detectorParams);
+
+        cv::RNG rng(2000);
+        const int frames = 40;
+        int posesFound = 0;
+        double detectionMs = 0;
+        std::vector<double> cornerErrors;
+        std::vector<std::vector<double>> rotationErrors(methodCount), translationErrors(methodCount);
+        std::vector<double> methodMs(methodCount, 0);
+        for (int i = 0; i < frames; i++) {
+            cv::Mat rvecTruth, tvecTruth;
+            samplePose(scene, camera, rng, 0.45, 1.2, 40, rvecTruth, tvecTruth);
+            cv::Mat image = renderView(scene, camera, rvecTruth, tvecTruth, condition, rng);
+
+            int64 start = cv::getTickCount();
+            cv::Mat undistorted;
+            cv::remap(image, undistorted, calibration.undistortMap, cv::noArray(), cv::INTER_LINEAR);
+            cv::Mat detectionImage = undistorted;
+            if (quality.detectionScale < 1.0) {
+                cv::resize(undistorted, detectionImage, cv::Size(), quality.detectionScale, quality.detectionScale, cv::INTER_AREA);
+            }
+            std::vector<std::vector<cv::Point2f>> markerCorners;
+            std::vector<int> markerIds;
+            fastDetector.detectMarkersTiled(detectionImage, markerCorners, markerIds, pool);
+            const float inverseScale = float(1.0 / quality.detectionScale);
+            for (auto& marker : markerCorners) {
+                for (auto& corner : marker) {
+                    corner = (corner + cv::Point2f(0.5f, 0.5f)) * inverseScale - cv::Point2f(0.5f, 0.5f);
+                }
+            }
+            std::vector<cv::Point2f> charucoCorners;
+            std::vector<int> charucoIds;
+            if (!markerIds.empty()) {
+                charucoDetector.detectBoard(undistorted, charucoCorners, charucoIds, markerCorners, markerIds);
+            }
+            detectionMs += elapsedMs(start);
+
+            std::vector<cv::Point3f> objectPoints;
+            std::vector<cv::Point2f> imagePoints;
+            if (charucoIds.size() >= 6) {
+                scene.board.matchImagePoints(charucoCorners, charucoIds, objectPoints, imagePoints);
+            }
+            if (objectPoints.size() < 6) continue;
+            posesFound++;
+
+            // The undistorted frame follows the pinhole model of K
+            std::vector<cv::Point2f> truePoints;
+            cv::projectPoints(objectPoints, rvecTruth, tvecTruth, camera.K, cv::noArray(), truePoints);
+            double squaredError = 0;
+            for (size_t k = 0; k < truePoints.size(); k++) {
+                cv::Point2f d = truePoints[k] - imagePoints[k];
+                squaredError += d.dot(d);
+            }
+            cornerErrors.push_back(std::sqrt(squaredError / double(truePoints.size())));
+
+            for (int m = 0; m < methodCount; m++) {
+                cv::Mat rvec, tvec;
+                start = cv::getTickCount();
+                bool solved = cv::solvePnP(objectPoints, imagePoints, camera.K, cv::noArray(), rvec, tvec, false, methods[m].flag);
+                methodMs[m] += elapsedMs(start);
+                rotationErrors[m].push_back(solved ? rotationErrorDegrees(rvec, rvecTruth) : 180.0);
+                translationErrors[m].push_back(solved ? 1000.0 * cv::norm(tvec, tvecTruth.reshape(1, 3)) : 1000.0);
+            }
+        }
+
+        // The cheapest level trades accuracy for time, so its limits are looser
+        const double limitScale = condition.limitScale * (level > 0 ? 2.0 : 1.0);
+        const std::string prefix = std::string("pose_") + condition.name + (level > 0 ? "_level" + std::to_string(level) : "") + "_";
+        std::cout << "\n=== Pose, " << condition.name << ", governor level " << level << " ===" << std::endl;
+        report(metrics, prefix + "found", double(posesFound) / frames, limitScale > 1 ? 0.75 : 0.9, true);
+        report(metrics, prefix + "detection_ms", detectionMs / frames, -1, false, true);
+        if (posesFound == 0) return;
+        report(metrics, prefix + "corner_error_px", median(cornerErrors), 0.6 * limitScale);
+        for (int m = 0; m < methodCount; m++) {
+            const std::string name = prefix + methods[m].name + "_";
+            report(metrics, name + "rotation_error_deg", median(rotationErrors[m]), methods[m].maxRotationDegrees * limitScale);
+            report(metrics, name + "translation_error_mm", median(translationErrors[m]), methods[m].maxTranslationMm * limitScale);
+            report(metrics, name + "us", 1000.0 * methodMs[m] / posesFound, -1, false, true);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string baselinePath, saveBaselinePath;
+    double tolerance = 0.25;
+    bool checkTimes = true;
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument == "--baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        }
+        else if (argument == "--save-baseline" && i + 1 < argc) {
+            saveBaselinePath = argv[++i];
+        }
+        else if (argument == "--tolerance" && i + 1 < argc) {
+            tolerance = std::atof(argv[++i]);
+        }
+        else if (argument == "--no-times") {
+            checkTimes = false;
+        }
+        else {
+            std::cerr << "Usage: PoseAccuracy [--baseline <file>] [--tolerance <fraction>] [--no-times] [--save-baseline <file>]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Board of Calibration.cpp and App.cpp
+    cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
+    cv::aruco::CharucoBoard board(cv::Size(5, 7), 0.038f, 0.019f, dictionary);
+
+    // A typical webcam with noticeable barrel distortion
+    Camera camera;
+    camera.size = cv::Size(1280, 720);
+    camera.K = (cv::Mat_<double>(3, 3) << 1000, 0, 642.5, 0, 1000, 357.5, 0, 0, 1);
+    camera.D = (cv::Mat_<double>(1, 5) << -0.21, 0.06, 0.0006, -0.0004, -0.008);
+
+    int64 start = cv::getTickCount();
+    Scene scene = makeScene(board, camera);
+    std::cout << "Scene ready in " << elapsedMs(start) << " ms" << std::endl;
+
+    const Condition conditions[] = {
+        { "clean", 0.0, 0.0, 1.0 },
+        { "noisy", 3.0, 0.8, 1.0 },
+        { "hard", 6.0, 1.5, 2.0 },
+    };
+
+    std::vector<Metric> metrics;
+    runCalibration(scene, camera, conditions[0], metrics);
+    runCalibration(scene, camera, conditions[1], metrics);
+    ThreadPool pool;
+    for (const auto& condition : conditions) {
+        runPose(scene, camera, condition, 0, pool, metrics);
+    }
+    runPose(scene, camera, conditions[0], FrameGovernor::levelCount - 1, pool, metrics);
+    runPose(scene, camera, conditions[1], FrameGovernor::levelCount - 1, pool, metrics);
+
+    int failures = 0;
+    for (const auto& metric : metrics) {
+        if (metric.limit < 0) continue;
+        bool failed = metric.higherIsBetter ? metric.value < metric.limit : metric.value > metric.limit;
+        if (failed) {
+            std::cerr << "FAILED: " << metric.name << " = " << metric.value << ", limit " << metric.limit << std::endl;
+            failures++;
+        }
+    }
+
+    // Regressions against an earlier run. Times only count when much slower, they vary between runs.
+    if (!baselinePath.empty()) {
+        cv::FileStorage fs(baselinePath, cv::FileStorage::READ);
+        if (!fs.isOpened()) {
+            std::cerr << "Failed to open baseline: " << baselinePath << std::endl;
+            return 1;
+        }
+        for (const auto& metric : metrics) {
+            if (metric.isTime && !checkTimes) continue;
+            cv::FileNode node = fs[metric.name];
+            if (node.empty()) continue;
+            double baseline = (double)node;
+            bool regressed;
+            if (metric.isTime) regressed = metric.value > baseline * (1.0 + 2.0 * tolerance) + 0.05;
+            else if (metric.higherIsBetter) regressed = metric.value < baseline - 0.2 * tolerance;
+            else regressed = metric.value > baseline * (1.0 + tolerance) + 0.01;
+            if (regressed) {
+                std::cerr << "REGRESSED: " << metric.name << " = " << metric.value << ", baseline " << baseline << std::endl;
+                failures++;
+            }
+        }
+    }
+
+    if (!saveBaselinePath.empty()) {
+        cv::FileStorage fs(saveBaselinePath, cv::FileStorage::WRITE);
+        if (!fs.isOpened()) {
+            std::cerr << "Failed to create baseline: " << saveBaselinePath << std::endl;
+            return 1;
+        }
+        for (const auto& metric : metrics) {
+            fs << metric.name << metric.value;
+        }
+        std::cout << "\nBaseline saved to: " << saveBaselinePath << std::endl;
+    }
+
+    std::cout << "\n" << (failures == 0 ? "All checks passed" : std::to_string(failures) + " checks failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+#include "PoseChannel.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <type_traits>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(std::is_trivially_copyable<PoseSample>::value, "Samples are copied word by word");
+
+namespace poseChannelDetail {
+    size_t mappingSize(uint32_t capacity) {
+        return sizeof(Header) + size_t(capacity) * sizeof(Slot);
+    }
+}
+
+using namespace poseChannelDetail;
+
+namespace {
+    // Slot contents are only ever touched through relaxed atomics, the lock orders them
+    bool readSlot(const Slot& slot, PoseSample& sample) {
+        uint64_t words[sampleWords];
+        for (int attempt = 0; attempt < 64; attempt++) {
+            uint64_t before = slot.lock.load(std::memory_order_acquire);
+            if (before & 1) continue;
+
+            for (size_t i = 0; i < sampleWords; i++) {
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.lock.load(std::memory_order_relaxed) == before) {
+                std::memcpy(&sample, words, sizeof(PoseSample));
+                return true;
+            }
+        }
+        return false; // Kept losing against the publisher
+    }
+}
+
+PosePublisher::~PosePublisher() {
+    close();
+}
+
+#ifndef _WIN32
+
+bool PosePublisher::open(const std::string& ringName, uint32_t capacity) {
+    close();
+    if (capacity == 0) capacity = 1;
+
+    // Start from an empty ring, readers of an old one keep their mapping until they open again
+    shm_unlink(ringName.c_str());
+    int fd = shm_open(ringName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to create shared memory " << ringName << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    size_t mappedSize = mappingSize(capacity);
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, off_t(mappedSize)) == 0) {
+        memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        std::cerr << "Failed to map shared memory " << ringName << ": " << std::strerror(errno) << std::endl;
+        shm_unlink(ringName.c_str());
+        return false;
+    }
+
+    // The file starts zeroed, which is a valid empty state for every slot
+    name = ringName;
+    mapping = memory;
+    size = mappedSize;
+    header = new (memory) Header();
+    slots = reinterpret_cast<Slot*>(static_cast<char*>(memory) + sizeof(Header));
+    for (uint32_t i = 0; i < capacity; i++) {
+        new (&slots[i]) Slot();
+    }
+    header->version = version;
+    header->capacity = capacity;
+    header->sampleSize = uint32_t(sizeof(PoseSample));
+    header->published.store(0, std::memory_order_relaxed);
+    header->magic.store(magic, std::memory_order_release); // Readers check this last
+    return true;
+}
+
+void PosePublisher::close() {
+    if (!mapping) return;
+    munmap(mapping, size);
+    shm_unlink(name.c_str());
+    mapping = nullptr;
+    header = nullptr;
+    slots = nullptr;
+}
+
+PoseReader::~PoseReader() {
+    close();
+}
+
+bool PoseReader::open(const std::string& name) {
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "Failed to open shared memory " << name << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat info;
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(Header)) {
+        memory = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        std::cerr << "Failed to map shared memory " << name << std::endl;
+        return false;
+    }
+
+    const Header* mapped = static_cast<const Header*>(memory);
+    bool valid = mapped->magic.load(std::memory_order_acquire) == magic && mapped->version == version &&
+        mapped->sampleSize == sizeof(PoseSample) && mapped->capacity > 0 &&
+        mappingSize(mapped->capacity) <= size_t(info.st_size);
+    if (!valid) {
+        std::cerr << "Shared memory " << name << " is not a pose ring of this version" << std::endl;
+        munmap(memory, size_t(info.st_size));
+        return false;
+    }
+
+    mapping = memory;
+    size = size_t(info.st_size);
+    header = mapped;
+    slots = reinterpret_cast<const Slot*>(static_cast<const char*>(memory) + sizeof(Header));
+    return true;
+}
+
+void PoseReader::close() {
+    if (!mapping) return;
+    munmap(mapping, size);
+    mapping = nullptr;
+    header = nullptr;
+    slots = nullptr;
+}
+
+#else
+
+bool PosePublisher::open(const std::string& ringName, uint32_t) {
+    std::cerr << "Pose publishing to " << ringName << " needs POSIX shared memory" << std::endl;
+    return false;
+}
+
+void PosePublisher::close() {
+}
+
+PoseReader::~PoseReader() {
+}
+
+bool PoseReader::open(const std::string& name) {
+    std::cerr << "Reading poses from " << name << " needs POSIX shared memory" << std::endl;
+    return false;
+}
+
+void PoseReader::close() {
+}
+
+#endif
+
+void PosePublisher::publish(const PoseSample& sample) {
+    if (!header) return;
+
+    // Only this process writes, so the counters need no read-modify-write
+    uint64_t index = header->published.load(std::memory_order_relaxed);
+    Slot& slot = slots[index % header->capacity];
+
+    PoseSample stamped = sample;
+    stamped.sequence = index + 1;
+    stamped.publishTimeNs = poseClockNs();
+    uint64_t words[sampleWords] = {};
+    std::memcpy(words, &stamped, sizeof(PoseSample));
+
+    uint64_t lock = slot.lock.load(std::memory_order_relaxed);
+    slot.lock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < sampleWords; i++) {
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot.lock.store(lock + 2, std::memory_order_release);
+    header->published.store(index + 1, std::memory_order_release);
+}
+
+uint64_t PoseReader::published() const {
+    return header ? header->published.load(std::memory_order_acquire) : 0;
+}
+
+bool PoseReader::latest(PoseSample& sample) const {
+    // The newest slot can only be overwritten if the publisher went around the whole ring meanwhile
+    for (int attempt = 0; attempt < 4; attempt++) {
+        uint64_t count = published();
+        if (count == 0) return false;
+        if (read(count, sample)) return true;
+    }
+    return false;
+}
+
+bool PoseReader::read(uint64_t sequence, PoseSample& sample) const {
+    if (!header || sequence == 0 || sequence > published()) return false;
+    const Slot& slot = slots[(sequence - 1) % header->capacity];
+    return readSlot(slot, sample) && sample.sequence == sequence;
+}
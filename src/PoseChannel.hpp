@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Board poses shared with other processes on the same host through a POSIX shared memory ring.
+// App writes one PoseSample per processed frame with PosePublisher, consumers map the same name
+// with PoseReader. Every slot is a seqlock: the publisher never waits for readers, and a reader
+// retries when it caught a slot in the middle of being written. Only one publisher per name.
+// Links against nothing but the C++ runtime, so consumers do not need OpenCV.
+
+// Clock of all timestamps in the ring, CLOCK_MONOTONIC on Linux
+inline int64_t poseClockNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct PoseSample {
+    static constexpr int maxCorners = 64;
+
+    enum Flags : uint32_t {
+        PoseValid = 1, // Pose solved from this frame
+        PoseHeld = 2,  // Board not found, pose of an earlier frame is kept on screen
+    };
+
+    uint64_t sequence = 0;     // Published samples before this one + 1, identifies the sample
+    int64_t captureTimeNs = 0; // When the frame was captured (device timestamp) or else read, poseClockNs()
+    int64_t publishTimeNs = 0; // When it was written to the ring, poseClockNs()
+    uint32_t streamIndex = 0;  // Camera in the order given to App
+    uint32_t flags = 0;
+
+    // OpenCV camera frame, board to camera
+    double rvec[3] = {};
+    double tvec[3] = {};
+    // Same pose as OpenGL view matrix, column major
+    float viewAR[16] = {};
+
+    // Quality of the pose
+    float reprojectionError = -1; // RMS in pixels, -1 without a pose
+    float detectionMs = 0;
+    uint32_t markerCount = 0;
+    uint32_t cornerCount = 0; // Entries used in cornerIds
+    int32_t cornerIds[maxCorners] = {};
+};
+
+namespace poseChannelDetail {
+    constexpr uint32_t magic = 0x45534f50; // "POSE"
+    constexpr uint32_t version = 1;
+    constexpr size_t sampleWords = (sizeof(PoseSample) + 7) / 8;
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "The ring needs lock free 64 bit atomics");
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> lock; // Odd while the publisher writes the slot
+        std::atomic<uint64_t> words[sampleWords];
+    };
+
+    struct alignas(64) Header {
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint32_t capacity;
+        uint32_t sampleSize;
+        std::atomic<uint64_t> published;
+    };
+
+    size_t mappingSize(uint32_t capacity);
+}
+
+class PosePublisher {
+public:
+    PosePublisher() = default;
+    ~PosePublisher();
+
+    PosePublisher(const PosePublisher&) = delete;
+    PosePublisher& operator=(const PosePublisher&) = delete;
+
+    // Creates the ring, replacing one left behind under the same name. Names look like "/vc_pose".
+    bool open(const std::string& name, uint32_t capacity = 64);
+    void close();
+    bool isOpen() const { return header != nullptr; }
+
+    // Fills in sequence and publishTimeNs. Never blocks, does no system calls.
+    void publish(const PoseSample& sample);
+
+private:
+    std::string name;
+    void* mapping = nullptr;
+    size_t size = 0;
+    poseChannelDetail::Header* header = nullptr;
+    poseChannelDetail::Slot* slots = nullptr;
+};
+
+class PoseReader {
+public:
+    PoseReader() = default;
+    ~PoseReader();
+
+    PoseReader(const PoseReader&) = delete;
+    PoseReader& operator=(const PoseReader&) = delete;
+
+    // Maps a ring created by PosePublisher. Fails if it does not exist yet or has another layout.
+    // A restarted publisher creates a new ring, open again when samples stop arriving.
+    bool open(const std::string& name);
+    void close();
+    bool isOpen() const { return header != nullptr; }
+
+    // Samples published so far
+    uint64_t published() const;
+
+    // Most recent sample, false if nothing was published yet
+    bool latest(PoseSample& sample) const;
+
+    // Sample with the given sequence number, false if it is not published yet or already overwritten.
+    // Readers that need every sample keep their own cursor and read forward from it.
+    bool read(uint64_t sequence, PoseSample& sample) const;
+
+private:
+    void* mapping = nullptr;
+    size_t size = 0;
+    const poseChannelDetail::Header* header = nullptr;
+    const poseChannelDetail::Slot* slots = nullptr;
+};
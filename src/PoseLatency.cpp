@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "PoseChannel.hpp"
+
+// Measures what publishing a pose costs the render loop and checks that readers never see a torn sample.
+// Exits with 1 when a publish takes a microsecond or more on average, or when a reader saw a broken sample.
+
+namespace {
+    // Every field is derived from the sequence, so a sample mixed from two publishes is detected
+    void fillSample(PoseSample& sample, uint64_t value) {
+        sample.captureTimeNs = int64_t(value);
+        sample.tvec[0] = double(value);
+        sample.viewAR[15] = float(value % 1000);
+        sample.cornerCount = uint32_t(value % PoseSample::maxCorners);
+        sample.cornerIds[PoseSample::maxCorners - 1] = int32_t(value);
+    }
+
+    bool isConsistent(const PoseSample& sample) {
+        uint64_t value = uint64_t(sample.captureTimeNs);
+        return sample.tvec[0] == double(value) && sample.viewAR[15] == float(value % 1000) &&
+            sample.cornerCount == uint32_t(value % PoseSample::maxCorners) &&
+            sample.cornerIds[PoseSample::maxCorners - 1] == int32_t(value) && sample.sequence == value;
+    }
+
+    // Mean nanoseconds per publish over a tight loop
+    double meanPublishNs(PosePublisher& publisher, PoseSample& sample, uint64_t& next, int iterations) {
+        int64_t start = poseClockNs();
+        for (int i = 0; i < iterations; i++) {
+            fillSample(sample, ++next);
+            publisher.publish(sample);
+        }
+        return double(poseClockNs() - start) / iterations;
+    }
+
+    double percentile(std::vector<int64_t>& values, double p) {
+        if (values.empty()) return 0;
+        size_t index = std::min(values.size() - 1, size_t(p * double(values.size())));
+        std::nth_element(values.begin(), values.begin() + std::ptrdiff_t(index), values.end());
+        return double(values[index]);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int iterations = argc > 1 ? std::max(1, std::stoi(argv[1])) : 2000000;
+    const std::string name = "/vc_pose_latency_" + std::to_string(getpid());
+
+    PosePublisher publisher;
+    if (!publisher.open(name)) {
+        return 1;
+    }
+    std::cout << "Sample size: " << sizeof(PoseSample) << " bytes, ring: " << name << std::endl;
+
+    PoseSample sample;
+    uint64_t next = 0;
+    meanPublishNs(publisher, sample, next, 10000); // Warm up
+
+    std::cout << "\n=== Publish cost, no reader ===" << std::endl;
+    std::cout << "Mean: " << meanPublishNs(publisher, sample, next, iterations) << " ns" << std::endl;
+
+    // A reader in its own mapping polls the newest sample as fast as it can, the worst case for the publisher
+    PoseReader reader;
+    if (!reader.open(name)) {
+        return 1;
+    }
+    std::atomic<bool> stop(false), paced(false);
+    uint64_t reads = 0, misses = 0, torn = 0;
+    std::vector<int64_t> visibleNs;
+    std::thread readerThread([&] {
+        uint64_t lastSeen = 0;
+        PoseSample seen;
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (!reader.latest(seen)) {
+                misses++;
+                continue;
+            }
+            reads++;
+            if (!isConsistent(seen)) torn++;
+            if (seen.sequence != lastSeen && paced.load(std::memory_order_acquire)) {
+                visibleNs.push_back(poseClockNs() - seen.publishTimeNs);
+            }
+            lastSeen = seen.sequence;
+        }
+    });
+
+    std::cout << "\n=== Publish cost, reader polling ===" << std::endl;
+    const double contendedNs = meanPublishNs(publisher, sample, next, iterations);
+    std::cout << "Mean: " << contendedNs << " ns" << std::endl;
+
+    // Per call, includes two clock reads
+    std::vector<int64_t> publishNs;
+    publishNs.reserve(200000);
+    for (int i = 0; i < 200000; i++) {
+        fillSample(sample, ++next);
+        int64_t start = poseClockNs();
+        publisher.publish(sample);
+        publishNs.push_back(poseClockNs() - start);
+    }
+    std::cout << "Per call p50: " << percentile(publishNs, 0.5) << " ns, p99: " << percentile(publishNs, 0.99)
+        << " ns, p99.9: " << percentile(publishNs, 0.999) << " ns" << std::endl;
+
+    // How long until the reader sees a sample, with publishes spaced like real frames but much closer.
+    // When reader and publisher share a core this is mostly scheduling.
+    visibleNs.reserve(20000);
+    paced = true;
+    for (int i = 0; i < 20000; i++) {
+        int64_t due = poseClockNs() + 20000;
+        while (poseClockNs() < due) {
+        }
+        fillSample(sample, ++next);
+        publisher.publish(sample);
+    }
+    paced = false;
+
+    stop = true;
+    readerThread.join();
+
+    std::cout << "\n=== Reader ===" << std::endl;
+    std::cout << "Reads: " << reads << ", retries exhausted: " << misses << ", torn samples: " << torn << std::endl;
+    std::cout << "Publish to read p50: " << percentile(visibleNs, 0.5) << " ns, p99: " << percentile(visibleNs, 0.99)
+        << " ns" << std::endl;
+
+    if (torn > 0) {
+        std::cerr << "FAILED: reader saw torn samples" << std::endl;
+        return 1;
+    }
+    if (contendedNs >= 1000.0) {
+        std::cerr << "FAILED: publish takes " << contendedNs << " ns, budget is 1000 ns" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool.
+// Every worker has its own queue and takes work from the back of it. Idle workers steal from the front
+// of the other queues, so one slow task does not hold up the tasks queued behind it.
+class ThreadPool {
+public:
+    // With zero threads everything runs on the thread calling parallelFor
+    explicit ThreadPool(unsigned threadCount = defaultThreadCount()) {
+        for (unsigned i = 0; i < std::max(1u, threadCount); i++) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (unsigned i = 0; i < threadCount; i++) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // The thread calling parallelFor helps out, so one worker less than the core count keeps every core busy
+    static unsigned defaultThreadCount() {
+        unsigned cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 1;
+    }
+
+    unsigned size() const { return unsigned(workers.size()); }
+
+    void submit(std::function<void()> task) {
+        Queue& queue = *queues[nextQueue++ % queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            pending++;
+        }
+        wake.notify_one();
+    }
+
+    // Runs f(i) for every i in [0, count) and returns once all of them are done
+    void parallelFor(int count, const std::function<void(int)>& f) {
+        std::atomic<int> remaining(count);
+        std::mutex doneMutex;
+        std::condition_variable done;
+
+        for (int i = 0; i < count; i++) {
+            submit([&, i] {
+                f(i);
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (--remaining == 0) done.notify_all();
+            });
+        }
+
+        // Help instead of sleeping while there is still queued work
+        std::function<void()> task;
+        while (remaining > 0 && tryPop(0, task)) {
+            task();
+        }
+
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [&] { return remaining == 0; });
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // Own queue first (newest task, still warm in cache), then steal the oldest task from the others
+    bool tryPop(unsigned index, std::function<void()>& task) {
+        for (size_t n = 0; n < queues.size(); n++) {
+            Queue& queue = *queues[(index + n) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+
+            if (n == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            std::lock_guard<std::mutex> wakeLock(wakeMutex);
+            pending--;
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(unsigned index) {
+        std::function<void()> task;
+        while (true) {
+            if (tryPop(index, task)) {
+                task();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait(lock, [this] { return pending > 0 || stopping; });
+            if (stopping) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<unsigned> nextQueue{ 0 };
+
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    int pending = 0;
+    bool stopping = false;
+};